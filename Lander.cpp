@@ -162,6 +162,9 @@
 
 #include "Lander_Control.h"
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
 
 double DD = -1;
 double ST_ANG = -1;
@@ -175,16 +178,92 @@ int VELOCITY_Y_OK = 1;
 int POSITION_X_OK = 1;
 int POSITION_Y_OK = 1;
 int ANGLE_OK = 1;
+int RANGEDIST_OK = 1;
 
 int FLAGPOSX = 1; 
 int FLAGPOSY = 1;
 int FLAGVELOX = 1;
 int FLAGVELOY = 1;
 int FLAGANGLE = 1;
+int FLAGRANGEDIST = 1;
 
 
 int count = 90;
 
+int POLICY_MODE = POLICY_LIVE;
+void (*LANDER_POLICIES[PT_NTHR])(void) = {Lander_Control_M, Lander_Control_R, Lander_Control_L};
+const Lander_Params LANDER_PARAMS_DEFAULT = {
+ {{10, 15, 10, 5}, {10, 15, 10, 5}, {10, 15, 10, 5}},
+ {{-20, -10, -4}, {-16, -7, -2}, {-16, -7, -2}},
+ 1.25,
+ 40, 30,
+ 20, 25,
+ {30, 15, 15},
+ {{20, 20}, {15, 15}, {20, 15}},
+ 75,
+ {EPSILON_POSITION_X, EPSILON_POSITION_Y, EPSILON_VELOCITY_X, EPSILON_VELOCITY_Y, EPSILON_ANGLE},
+ AMOUNT_OF_FAULTY
+};
+Lander_Params LANDER_PARAMS = LANDER_PARAMS_DEFAULT;
+// Names of the LP_N values in struct order, as used in parameter files
+const char *LP_NAMES[] = {
+ "vx_lim.m.0", "vx_lim.m.1", "vx_lim.m.2", "vx_lim.m.3",
+ "vx_lim.r.0", "vx_lim.r.1", "vx_lim.r.2", "vx_lim.r.3",
+ "vx_lim.l.0", "vx_lim.l.1", "vx_lim.l.2", "vx_lim.l.3",
+ "vy_lim.m.0", "vy_lim.m.1", "vy_lim.m.2",
+ "vy_lim.r.0", "vy_lim.r.1", "vy_lim.r.2",
+ "vy_lim.l.0", "vy_lim.l.1", "vy_lim.l.2",
+ "over_ratio", "cut_dx", "cut_dy", "column_l", "column_r",
+ "hold_dx.m", "hold_dx.r", "hold_dx.l",
+ "side_dx.m.right", "side_dx.m.left", "side_dx.r.right", "side_dx.r.left",
+ "side_dx.l.right", "side_dx.l.left",
+ "dist_limit",
+ "eps.pos_x", "eps.pos_y", "eps.vel_x", "eps.vel_y", "eps.angle",
+ "faulty"
+};
+static_assert(sizeof(LP_NAMES) / sizeof(LP_NAMES[0]) == LP_N, "a name for every parameter");
+static PT_Entry *policy_table = NULL;
+static double plan_state[5], plan_dir, plan_power[3];
+static double roll_att, roll_power[3];
+static int roll_active = 0;
+// Occupancy map: tile tags kept apart from the cells so probing for a
+// tile touches one cache line, each tile's cells are one 256 byte block
+static int occ_tx[OCC_TILES], occ_ty[OCC_TILES], occ_used[OCC_TILES];
+static unsigned char occ_cell[OCC_TILES][OCC_TILE * OCC_TILE];
+static int occ_tick = 0;
+static double occ_last[36], occ_ring[36], occ_held[36];
+// Heading estimate, see Angle_Update()
+static double ae_ang = 0, ae_pend = 0;
+// Velocity estimate, see Motion_Update()
+static double mv_vx = 0, mv_vy = 0, mv_power[3];
+// Ticks of Lander_Control() since the reset, for its schedule
+static int sched_tick = 0;
+// Sonar health, see Sonar_Update()
+double SONAR_CLEAN[36];
+int SONAR_VALID[36];
+static double sn_ring[SONAR_HIST][36], sn_last[36], sn_rate;
+static int sn_pos[36];
+// Lazy safety override, see Safety_Override(): ticks it may still sit
+// out, ticks before a bound that didn't hold is tried again, the health
+// flags and returns its bound was worked out from
+static int sf_quiet = 0, sf_wait = 0, sf_health = -1;
+static double sf_seen[36];
+// Commands issued through Robust_*(), to tell whether the override
+// changed any
+static long cmd_count = 0;
+// Mission phase, see Phase_Update()
+int LANDER_PHASE = -1;
+const char *PHASE_NAMES[PHASE_N] = {"cruise", "traverse", "align", "descent"};
+Phase_Event PHASE_EVENTS[PHASE_LOG];
+int PHASE_COUNT = 0;
+
+const double PT_DX_NODES[PT_NDX] = {-600, -400, -300, -200, -150, -100, -60, -40, -30, -25,
+                                    -20, -15, -10, -5, 0, 5, 10, 15, 20, 25,
+                                    30, 40, 60, 100, 150, 200, 300, 400, 600};
+const double PT_DY_NODES[PT_NDY] = {-50, 0, 15, 30, 50, 75, 100, 150, 200, 250, 300, 400, 600, 900};
+const double PT_VX_NODES[PT_NVX] = {-25, -15, -10, -5, -2, -.5, 0, .5, 2, 5, 10, 15, 25};
+const double PT_VY_NODES[PT_NVY] = {-40, -25, -20, -16, -10, -7, -4, -2, -1, 0, 2, 5, 10};
+
 
 double (*Velocity_X_alt)(void) = &Velocity_X;
 double (*Velocity_Y_alt)(void) = &Velocity_Y;
@@ -194,6 +273,170 @@ double (*Angle_alt)(void) = &Angle;
 double (*RangeDist_alt)(void) = &RangeDist;
 
 
+// Restores the flight computer to its power-on state so the headless
+// simulator can fly many episodes in one process
+void Lander_Reset(void) {
+  for (int i = 0; i < 22; i++) {
+    POS_X[i] = POS_Y[i] = 0;
+    VEL_X[i] = VEL_Y[i] = 0;
+  }
+  VELOCITY_X_OK = VELOCITY_Y_OK = 1;
+  POSITION_X_OK = POSITION_Y_OK = 1;
+  ANGLE_OK = 1;
+  RANGEDIST_OK = 1;
+  FLAGPOSX = FLAGPOSY = FLAGVELOX = FLAGVELOY = FLAGANGLE = FLAGRANGEDIST = 1;
+  count = 90;
+  Velocity_X_alt = &Velocity_X;
+  Velocity_Y_alt = &Velocity_Y;
+  Position_X_alt = &Position_X;
+  Position_Y_alt = &Position_Y;
+  Angle_alt = &Angle;
+  RangeDist_alt = &RangeDist;
+  ae_pend = 0;
+  mv_power[0] = mv_power[1] = mv_power[2] = 0;
+  sched_tick = 0;
+  for (int i = 0; i < 36; i++) {
+    for (int k = 0; k < SONAR_HIST; k++) sn_ring[k][i] = SONAR_FAR;
+    sn_last[i] = SONAR_CLEAN[i] = -1;
+    sn_pos[i] = 0;
+    SONAR_VALID[i] = 1;
+  }
+  sn_rate = 0;
+  sf_quiet = sf_wait = 0;
+  sf_health = -1;
+  // No escape carries over into the next flight
+  for (int i = 0; i < 5; i++) plan_state[i] = 0;
+  plan_dir = roll_att = 0;
+  for (int i = 0; i < 3; i++) plan_power[i] = roll_power[i] = 0;
+  roll_active = 0;
+  Phase_Reset();
+  Occupancy_Reset();
+}
+
+void Lander_Save(Lander_State *s) {
+  memcpy(s->pos_x, POS_X, sizeof(POS_X));
+  memcpy(s->pos_y, POS_Y, sizeof(POS_Y));
+  memcpy(s->vel_x, VEL_X, sizeof(VEL_X));
+  memcpy(s->vel_y, VEL_Y, sizeof(VEL_Y));
+  s->ok[0] = VELOCITY_X_OK;
+  s->ok[1] = VELOCITY_Y_OK;
+  s->ok[2] = POSITION_X_OK;
+  s->ok[3] = POSITION_Y_OK;
+  s->ok[4] = ANGLE_OK;
+  s->ok[5] = RANGEDIST_OK;
+  s->flag[0] = FLAGPOSX;
+  s->flag[1] = FLAGPOSY;
+  s->flag[2] = FLAGVELOX;
+  s->flag[3] = FLAGVELOY;
+  s->flag[4] = FLAGANGLE;
+  s->flag[5] = FLAGRANGEDIST;
+  s->count = count;
+  s->dd = DD;
+  s->st_ang = ST_ANG;
+  s->alt[0] = Velocity_X_alt;
+  s->alt[1] = Velocity_Y_alt;
+  s->alt[2] = Position_X_alt;
+  s->alt[3] = Position_Y_alt;
+  s->alt[4] = Angle_alt;
+  s->alt[5] = RangeDist_alt;
+  memcpy(s->plan_state, plan_state, sizeof(plan_state));
+  s->plan_dir = plan_dir;
+  memcpy(s->plan_power, plan_power, sizeof(plan_power));
+  s->roll_att = roll_att;
+  memcpy(s->roll_power, roll_power, sizeof(roll_power));
+  s->roll_active = roll_active;
+  memcpy(s->occ_tx, occ_tx, sizeof(occ_tx));
+  memcpy(s->occ_ty, occ_ty, sizeof(occ_ty));
+  memcpy(s->occ_used, occ_used, sizeof(occ_used));
+  memcpy(s->occ_cell, occ_cell, sizeof(occ_cell));
+  s->occ_tick = occ_tick;
+  memcpy(s->occ_last, occ_last, sizeof(occ_last));
+  memcpy(s->occ_ring, occ_ring, sizeof(occ_ring));
+  memcpy(s->occ_held, occ_held, sizeof(occ_held));
+  s->ae_ang = ae_ang;
+  s->ae_pend = ae_pend;
+  s->mv_vx = mv_vx;
+  s->mv_vy = mv_vy;
+  memcpy(s->mv_power, mv_power, sizeof(mv_power));
+  s->sched_tick = sched_tick;
+  memcpy(s->sn_ring, sn_ring, sizeof(sn_ring));
+  memcpy(s->sn_last, sn_last, sizeof(sn_last));
+  s->sn_rate = sn_rate;
+  memcpy(s->sonar_clean, SONAR_CLEAN, sizeof(SONAR_CLEAN));
+  memcpy(s->sn_pos, sn_pos, sizeof(sn_pos));
+  memcpy(s->sonar_valid, SONAR_VALID, sizeof(SONAR_VALID));
+  s->sf_quiet = sf_quiet;
+  s->sf_wait = sf_wait;
+  s->sf_health = sf_health;
+  memcpy(s->sf_seen, sf_seen, sizeof(sf_seen));
+  s->phase = LANDER_PHASE;
+  s->phase_count = PHASE_COUNT;
+  memcpy(s->phase_events, PHASE_EVENTS, sizeof(PHASE_EVENTS));
+  s->cmd_count = cmd_count;
+}
+
+void Lander_Restore(const Lander_State *s) {
+  memcpy(POS_X, s->pos_x, sizeof(POS_X));
+  memcpy(POS_Y, s->pos_y, sizeof(POS_Y));
+  memcpy(VEL_X, s->vel_x, sizeof(VEL_X));
+  memcpy(VEL_Y, s->vel_y, sizeof(VEL_Y));
+  VELOCITY_X_OK = s->ok[0];
+  VELOCITY_Y_OK = s->ok[1];
+  POSITION_X_OK = s->ok[2];
+  POSITION_Y_OK = s->ok[3];
+  ANGLE_OK = s->ok[4];
+  RANGEDIST_OK = s->ok[5];
+  FLAGPOSX = s->flag[0];
+  FLAGPOSY = s->flag[1];
+  FLAGVELOX = s->flag[2];
+  FLAGVELOY = s->flag[3];
+  FLAGANGLE = s->flag[4];
+  FLAGRANGEDIST = s->flag[5];
+  count = s->count;
+  DD = s->dd;
+  ST_ANG = s->st_ang;
+  Velocity_X_alt = s->alt[0];
+  Velocity_Y_alt = s->alt[1];
+  Position_X_alt = s->alt[2];
+  Position_Y_alt = s->alt[3];
+  Angle_alt = s->alt[4];
+  RangeDist_alt = s->alt[5];
+  memcpy(plan_state, s->plan_state, sizeof(plan_state));
+  plan_dir = s->plan_dir;
+  memcpy(plan_power, s->plan_power, sizeof(plan_power));
+  roll_att = s->roll_att;
+  memcpy(roll_power, s->roll_power, sizeof(roll_power));
+  roll_active = s->roll_active;
+  memcpy(occ_tx, s->occ_tx, sizeof(occ_tx));
+  memcpy(occ_ty, s->occ_ty, sizeof(occ_ty));
+  memcpy(occ_used, s->occ_used, sizeof(occ_used));
+  memcpy(occ_cell, s->occ_cell, sizeof(occ_cell));
+  occ_tick = s->occ_tick;
+  memcpy(occ_last, s->occ_last, sizeof(occ_last));
+  memcpy(occ_ring, s->occ_ring, sizeof(occ_ring));
+  memcpy(occ_held, s->occ_held, sizeof(occ_held));
+  ae_ang = s->ae_ang;
+  ae_pend = s->ae_pend;
+  mv_vx = s->mv_vx;
+  mv_vy = s->mv_vy;
+  memcpy(mv_power, s->mv_power, sizeof(mv_power));
+  sched_tick = s->sched_tick;
+  memcpy(sn_ring, s->sn_ring, sizeof(sn_ring));
+  memcpy(sn_last, s->sn_last, sizeof(sn_last));
+  sn_rate = s->sn_rate;
+  memcpy(SONAR_CLEAN, s->sonar_clean, sizeof(SONAR_CLEAN));
+  memcpy(sn_pos, s->sn_pos, sizeof(sn_pos));
+  memcpy(SONAR_VALID, s->sonar_valid, sizeof(SONAR_VALID));
+  sf_quiet = s->sf_quiet;
+  sf_wait = s->sf_wait;
+  sf_health = s->sf_health;
+  memcpy(sf_seen, s->sf_seen, sizeof(sf_seen));
+  LANDER_PHASE = s->phase;
+  PHASE_COUNT = s->phase_count;
+  memcpy(PHASE_EVENTS, s->phase_events, sizeof(PHASE_EVENTS));
+  cmd_count = s->cmd_count;
+}
+
 void Faulty_Checker(void) {
   int faulty_pos_x_counter = 0;
   int faulty_pos_y_counter = 0;
@@ -201,31 +444,84 @@ void Faulty_Checker(void) {
   int faulty_velo_y_counter = 0;
   int faulty_angle_counter = 0;
   for (int i = 0; i < 25; i++ ) {
-    if (POSITION_X_OK && (Position_X() - Position_X()) > EPSILON_POSITION_X) {
+    if (POSITION_X_OK && (Position_X() - Position_X()) > LANDER_PARAMS.eps[0]) {
       faulty_pos_x_counter++;
     }
-    if (POSITION_Y_OK && fabs(Position_Y() - Position_Y()) > EPSILON_POSITION_Y) {
+    if (POSITION_Y_OK && fabs(Position_Y() - Position_Y()) > LANDER_PARAMS.eps[1]) {
       faulty_pos_y_counter++;
     }
-    if (VELOCITY_X_OK && fabs(Velocity_X() - Velocity_X()) > EPSILON_VELOCITY_X) {
+    if (VELOCITY_X_OK && fabs(Velocity_X() - Velocity_X()) > LANDER_PARAMS.eps[2]) {
       faulty_velo_x_counter++;
     } 
-    if (VELOCITY_Y_OK && fabs(Velocity_Y() - Velocity_Y()) > EPSILON_VELOCITY_Y) {
+    if (VELOCITY_Y_OK && fabs(Velocity_Y() - Velocity_Y()) > LANDER_PARAMS.eps[3]) {
       faulty_velo_y_counter++;
     }
-    if (ANGLE_OK && fabs(Angle() - Angle()) > EPSILON_ANGLE) {
+    if (ANGLE_OK && fabs(Angle() - Angle()) > LANDER_PARAMS.eps[4]) {
       faulty_angle_counter++;
     }
   }
 
-  if (faulty_pos_x_counter >= AMOUNT_OF_FAULTY) POSITION_X_OK = 0;
-  if (faulty_pos_y_counter >= AMOUNT_OF_FAULTY) POSITION_Y_OK = 0;
-  if (faulty_velo_x_counter >= AMOUNT_OF_FAULTY) VELOCITY_X_OK = 0;
-  if (faulty_velo_y_counter >= AMOUNT_OF_FAULTY) VELOCITY_Y_OK = 0;
-  if (faulty_angle_counter >= AMOUNT_OF_FAULTY) ANGLE_OK = 0;
+  if (faulty_pos_x_counter >= LANDER_PARAMS.faulty) POSITION_X_OK = 0;
+  if (faulty_pos_y_counter >= LANDER_PARAMS.faulty) POSITION_Y_OK = 0;
+  if (faulty_velo_x_counter >= LANDER_PARAMS.faulty) VELOCITY_X_OK = 0;
+  if (faulty_velo_y_counter >= LANDER_PARAMS.faulty) VELOCITY_Y_OK = 0;
+  if (faulty_angle_counter >= LANDER_PARAMS.faulty) ANGLE_OK = 0;
   return;
 }
 
+static inline void Sort_Pair(double *a, double *b) {
+  double lo = *a < *b ? *a : *b;
+  *b = *a < *b ? *b : *a;
+  *a = lo;
+}
+
+// Sonar health monitor and outlier filter, O(36) a tick. Only rays with
+// a new reading are judged, a reading the sonar holds from one tick to
+// the next keeps its verdict. The medians of all 36 rings are taken at
+// once by a branch free sorting network, one lane per ray.
+static_assert(SONAR_HIST == 5, "Sonar_Update()'s median network takes exactly 5 inputs");
+void Sonar_Update(void) {
+  double med[36], p[SONAR_HIST], d, n1, n2, tol;
+  int bad;
+
+  for (int i = 0; i < 36; i++) {
+    for (int k = 0; k < SONAR_HIST; k++) p[k] = sn_ring[k][i];
+    Sort_Pair(&p[0], &p[1]);
+    Sort_Pair(&p[3], &p[4]);
+    Sort_Pair(&p[0], &p[3]);
+    Sort_Pair(&p[1], &p[4]);
+    Sort_Pair(&p[1], &p[2]);
+    Sort_Pair(&p[2], &p[3]);
+    Sort_Pair(&p[1], &p[2]);
+    med[i] = p[2];
+  }
+
+  for (int i = 0; i < 36; i++) {
+    d = SONAR_DIST[i];
+    if (d == sn_last[i]) continue;
+    sn_last[i] = d;
+    bad = 0;
+    if (d > -1) {
+      n1 = SONAR_DIST[(i + 35) % 36];
+      n2 = SONAR_DIST[(i + 1) % 36];
+      tol = SONAR_TOL + SONAR_SPREAD * d;
+      bad = d < SONAR_MIN || (fabs(d - med[i]) > SONAR_TOL && !(n1 >= SONAR_MIN && fabs(d - n1) <= tol) &&
+                              !(n2 >= SONAR_MIN && fabs(d - n2) <= tol));
+      sn_rate += (bad - sn_rate) / SONAR_WINDOW;
+    }
+    SONAR_VALID[i] = !bad;
+    sn_ring[sn_pos[i]][i] = d > -1 ? d : SONAR_FAR;
+    sn_pos[i] = (sn_pos[i] + 1) % SONAR_HIST;
+  }
+  if (sn_rate > SONAR_FAULTY) RANGEDIST_OK = 0;
+
+  for (int i = 0; i < 36; i++) {
+    if (!RANGEDIST_OK) SONAR_CLEAN[i] = -1;
+    else if (SONAR_VALID[i]) SONAR_CLEAN[i] = SONAR_DIST[i];
+    else SONAR_CLEAN[i] = med[i] < SONAR_FAR ? med[i] : -1;
+  }
+}
+
 
 void Setting_Up_Arrays(void) {
   // move elements array to the right;
@@ -237,14 +533,14 @@ void Setting_Up_Arrays(void) {
   // get new data point by taking average of 100000 measurements
   double new_reading_x = 0;
   double new_reading_y = 0;
-  for(int a = 0; a < 1000000; a++){
+  for(int a = 0; a < POSITION_SAMPLES; a++){
       new_reading_x += Position_X_alt();
       new_reading_y += Position_Y_alt();
   }
   
-  new_reading_x = new_reading_x / 1000000;
+  new_reading_x = new_reading_x / POSITION_SAMPLES;
   POS_X[0] = new_reading_x;
-  new_reading_y = new_reading_y / 1000000;
+  new_reading_y = new_reading_y / POSITION_SAMPLES;
   POS_Y[0] = new_reading_y;
   
   if(count % 500 == 0){
@@ -267,30 +563,55 @@ void Setting_Up_Arrays(void) {
 
 
 
-double Robust_Velocity_X(void) {
-  // makes use of position_x
+// Velocity (px per tick) over the position history, the way a broken
+// velocity sensor used to be replaced outright
+static double Position_Slope(const double *pos){
   double distance = 0;
   double count = 0;
-  for (int i = 0; i < 21 ; i++) {
-    if(POS_X[i] == 0 || POS_X[i+1] == 0) continue;
-     distance += (POS_X[i] - POS_X[i+1]);
+  for (int i = 0; i < 21; i++) {
+    if(pos[i] == 0 || pos[i+1] == 0) continue;
+     distance += (pos[i] - pos[i+1]);
      count++; 
   }
-  
-  return (distance/count)/(T_STEP)/(S_SCALE);
+  return distance/count;
 }
 
-double Robust_Velocity_Y(void) {
-  // makes use of position_y
-  double distance = 0;
-  double count = 0;
-  for (int i = 0; i < 21; i++) {
-    if(POS_Y[i] == 0 || POS_Y[i+1] == 0) continue;
-     distance += -((POS_Y[i] - POS_Y[i+1]));
-     count++; 
+// Velocity estimate for broken velocity sensors. The thrust commands
+// (recorded by Robust_MT/RT/LT()) and the heading give the acceleration
+// the simulator applied since the last tick, integrated the way it
+// integrates it. While the position along that axis still works the
+// slope of its history pulls the estimate in, once it doesn't either
+// Scan_Match() is what keeps it honest. Motion_Update() runs once per
+// tick, Robust_Velocity_X/Y() just return the estimate.
+void Motion_Update(double ang){
+  double a = ang * PI / 180, f[3], ax, ay;
+  int ok[3] = {MT_OK, RT_OK, LT_OK};
+  double accel[3] = {MT_ACCEL, RT_ACCEL, LT_ACCEL};
+
+  // Thrust noise scales the command by 1 - NP1 and adds up to NP1
+  for (int i = 0; i < 3; i++)
+    f[i] = ok[i] * accel[i] * ((1 - NP1) * fmax(0, fmin(1, mv_power[i])) + NP1 / 2);
+  ax = f[0] * sin(a) + (f[2] - f[1]) * cos(a);
+  ay = f[0] * cos(a) - (f[2] - f[1]) * sin(a) - G_ACCEL;
+
+  if (VELOCITY_X_OK) mv_vx = Velocity_X();
+  else {
+    mv_vx += ax * T_STEP;
+    if (POSITION_X_OK) mv_vx += MOTION_GAIN * (Position_Slope(POS_X) / T_STEP / S_SCALE - mv_vx);
   }
-  
-  return (distance/count)/(T_STEP)/(S_SCALE);
+  if (VELOCITY_Y_OK) mv_vy = Velocity_Y();
+  else {
+    mv_vy += ay * T_STEP;
+    if (POSITION_Y_OK) mv_vy += MOTION_GAIN * (-Position_Slope(POS_Y) / T_STEP / S_SCALE - mv_vy);
+  }
+}
+
+double Robust_Velocity_X(void) {
+  return mv_vx;
+}
+
+double Robust_Velocity_Y(void) {
+  return mv_vy;
 }
 
 double Robust_Position_X(void) {
@@ -299,8 +620,91 @@ double Robust_Position_X(void) {
 }
 
 double Robust_Position_Y(void) {
+  // y grows downward, the velocity is positive upward
   double velocity = Velocity_Y_alt();
-  return POS_Y[0] + velocity*T_STEP*S_SCALE;
+  return POS_Y[0] - velocity*T_STEP*S_SCALE;
+}
+
+// Heading estimate for when the angle sensor is broken. The lander only
+// turns when told to, so the estimate follows every Robust_Rot()
+// command the way the simulator carries it out: through the rotation
+// noise on average, consumed at MAX_ROT_RATE per tick, replaced by the
+// next command. What that misses, the random part of the rotation
+// noise, is taken out by the broken sensor itself. A few of its
+// readings per tick are averaged as unit vectors, so 359 and 1 don't
+// average to 180, and pull the estimate in slowly.
+//
+// That correction relies on the broken sensor still reading centred on
+// the true angle. It does in both simulators: once failed, Angle() in
+// Lander_Control.o returns (ang + drand48() * 2.5 - 1.25) * 57.2958,
+// the true angle plus uniform noise of +/-1.25 rad, and Lander_Sim
+// does the same with Sim_Rand().
+//
+// Angle_Update() runs once per tick before anything reads the angle,
+// Robust_Angle() just returns the estimate.
+void Angle_Update(void){
+  double step = MAX_ROT_RATE * 180 / PI, d, s = 0, c = 0, a;
+
+  // The turn the simulator made since the last tick
+  d = fmax(-step, fmin(step, ae_pend));
+  ae_ang += d;
+  ae_pend -= d;
+
+  if (ANGLE_OK) ae_ang = Angle();
+  else {
+    for (int i = 0; i < ANGLE_SAMPLES; i++){
+      a = Angle() * PI / 180;
+      s += sin(a);
+      c += cos(a);
+    }
+    ae_ang += ANGLE_GAIN * (fmod(atan2(s, c) * 180 / PI - ae_ang + 540, 360) - 180);
+  }
+  ae_ang = fmod(ae_ang + 360, 360);
+}
+
+double Robust_Angle(void) {
+  return ae_ang;
+}
+
+// The phase for the policies' speed limit bands. Before Phase_Update()
+// has placed the lander (-1), cruise, the loosest assumption, rather
+// than an index off the band tables.
+int Phase_Band(void){
+  return LANDER_PHASE < PHASE_CRUISE ? PHASE_CRUISE : LANDER_PHASE;
+}
+
+void Phase_Reset(void){
+  LANDER_PHASE = -1;
+  PHASE_COUNT = 0;
+}
+
+// The phase the lander at (x, y) is in. Leaving the current phase takes
+// PHASE_HYST px more than entering it would: each boundary is moved
+// PHASE_HYST px away from the side the lander is on. Right after
+// Phase_Reset() there is no side yet and the boundaries are where they
+// are, so Policy_Gen gets the phase as a function of the position.
+void Phase_Update(double x, double y){
+  double dx = fabs(x - PLAT_X), dy = PLAT_Y - y;
+  double h = LANDER_PHASE < 0 ? 0 : PHASE_HYST, far, near, low;
+  int p;
+  Phase_Event *ev;
+
+  far = LANDER_PHASE == PHASE_CRUISE ? PHASE_FAR - h : PHASE_FAR + h;
+  near = LANDER_PHASE >= PHASE_ALIGN ? PHASE_NEAR + h : PHASE_NEAR - h;
+  low = LANDER_PHASE == PHASE_DESCENT ? PHASE_LOW + h : PHASE_LOW - h;
+  if (dx > far) p = PHASE_CRUISE;
+  else if (dx > near) p = PHASE_TRAVERSE;
+  else if (dy > low) p = PHASE_ALIGN;
+  else p = PHASE_DESCENT;
+  if (p == LANDER_PHASE) return;
+
+  ev = &PHASE_EVENTS[PHASE_COUNT++ % PHASE_LOG];
+  ev->tick = sched_tick;
+  ev->from = LANDER_PHASE;
+  ev->to = p;
+  ev->dx = x - PLAT_X;
+  ev->dy = dy;
+  LANDER_PHASE = p;
 }
 
 void Sensor_Adjustment(void) {
@@ -317,6 +721,9 @@ void Sensor_Adjustment(void) {
   if (!POSITION_Y_OK) {
     Position_Y_alt = &Robust_Position_Y;
   }
+  if (!ANGLE_OK) {
+    Angle_alt = &Robust_Angle;
+  }
   return;
 }
 
@@ -324,11 +731,28 @@ void Sensor_Adjustment(void) {
 
 
 
-void Lander_Control(void)
+// The position history carried on by one tick of dead reckoning
+// instead of averaged readings, see Lander_Coast()
+static void Coast_Arrays(void) {
+  for (int i = 21; i > 0; i--) {
+    POS_X[i] = POS_X[i-1];
+    POS_Y[i] = POS_Y[i-1];
+  }
+  POS_X[0] += Robust_Velocity_X() * T_STEP * S_SCALE;
+  POS_Y[0] -= Robust_Velocity_Y() * T_STEP * S_SCALE;
+  count++;
+}
+
+// Stages of Lander_Control(), in the order they run in a tick. The
+// heading is read once per tick, every reading of a working sensor
+// being a fresh noisy one.
+static int measure_tick;
+static double tick_ang;
+
+static void Stage_Health(void)
 {
  Faulty_Checker();
  Sensor_Adjustment();
- Setting_Up_Arrays();
  
  if (!POSITION_X_OK && FLAGPOSX) {
   //printf("The X_POSITION sensor is broken! \n");
@@ -353,11 +777,668 @@ void Lander_Control(void)
   //printf("The angle sensor is broken! \n");
   FLAGANGLE = 0;
  }
-  
+}
+
+static void Stage_Sonar(void)
+{
+ Sonar_Update();
+ if (!RANGEDIST_OK && FLAGRANGEDIST) {
+  //printf("The sonar is broken! \n");
+  FLAGRANGEDIST = 0;
+ }
+}
+
+static void Stage_Attitude(void)
+{
+ Angle_Update();
+ tick_ang = Robust_Ang();
+}
+
+static void Stage_Motion(void)
+{
+ Motion_Update(tick_ang);
+}
+
+static void Stage_History(void)
+{
+ if (measure_tick) Setting_Up_Arrays();
+ else Coast_Arrays();
+}
+
+static void Stage_Scan(void)
+{
+ if (!POSITION_X_OK || !POSITION_Y_OK) Scan_Match(&POS_X[0], &POS_Y[0], tick_ang);
+}
+
+static void Stage_Map(void)
+{
+ Occupancy_Update(POS_X[0], POS_Y[0], tick_ang);
+}
+
+static void Stage_Phase(void)
+{
+ Phase_Update(POS_X[0], POS_Y[0]);
+}
+
+static void Stage_Policy(void)
+{
+ if (POLICY_MODE == POLICY_TABLE && Policy_Table_Control()) return;
+ if (POLICY_MODE == POLICY_PLAN && Plan_Control()) return;
+
  //if(MT_OK && RT_OK && LT_OK) Lander_Control_N();
- if(MT_OK) Lander_Control_M();
- else if(RT_OK) Lander_Control_R();
- else if(LT_OK) Lander_Control_L();
+ if(MT_OK) LANDER_POLICIES[0]();
+ else if(RT_OK) LANDER_POLICIES[1]();
+ else if(LT_OK) LANDER_POLICIES[2]();
+}
+
+// The schedule. A stage runs on the ticks where tick % period == offset;
+// the estimators and the policy need every tick, stages given a slower
+// period are offset against each other so no tick runs two of them.
+// "safety" is Safety_Override(), which the simulator calls after
+// Lander_Control(), and is only here to be timed.
+Lander_Stage LANDER_STAGES[STAGE_N] = {
+ {"health", STAGE_HEALTH, 0, Stage_Health, 0, 0, 0, 0},
+ {"sonar", 1, 0, Stage_Sonar, 0, 0, 0, 0},
+ {"attitude", 1, 0, Stage_Attitude, 0, 0, 0, 0},
+ {"motion", 1, 0, Stage_Motion, 0, 0, 0, 0},
+ {"history", 1, 0, Stage_History, 0, 0, 0, 0},
+ {"scan", STAGE_SCAN, 1, Stage_Scan, 0, 0, 0, 0},
+ {"map", STAGE_MAP, 2, Stage_Map, 0, 0, 0, 0},
+ {"phase", 1, 0, Stage_Phase, 0, 0, 0, 0},
+ {"policy", 1, 0, Stage_Policy, 0, 0, 0, 0},
+ {"safety", 1, 0, NULL, 0, 0, 0, 0},
+};
+Lander_Tick LANDER_TICK;
+Safety_Stats SAFETY_STATS;
+int SAFETY_LAZY = 1;
+static double tick_cost;
+
+static double Stage_Clock(void)
+{
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Stage_Account(Lander_Stage *st, double t)
+{
+ st->runs++;
+ st->last = t;
+ st->total += t;
+ if (t > st->worst) st->worst = t;
+ tick_cost += t;
+}
+
+static void Control_Tick(int measure)
+{
+ double t;
+
+ Policy_Select();
+ measure_tick = measure;
+ tick_cost = 0;
+ for (int i = 0; i < STAGE_N; i++) {
+  Lander_Stage *st = &LANDER_STAGES[i];
+  if (!st->run || sched_tick % st->period != st->offset % st->period) continue;
+  t = Stage_Clock();
+  st->run();
+  Stage_Account(st, Stage_Clock() - t);
+ }
+ sched_tick++;
+}
+
+// Zeroes the costs Lander_Stage_Report() prints
+void Lander_Stage_Clear(void)
+{
+ for (int i = 0; i < STAGE_N; i++) {
+  LANDER_STAGES[i].runs = 0;
+  LANDER_STAGES[i].last = LANDER_STAGES[i].total = LANDER_STAGES[i].worst = 0;
+ }
+ memset(&LANDER_TICK, 0, sizeof(LANDER_TICK));
+ memset(&SAFETY_STATS, 0, sizeof(SAFETY_STATS));
+}
+
+void Lander_Stage_Report(void)
+{
+ printf("stage     period  runs        mean us  worst us  share\n");
+ for (int i = 0; i < STAGE_N; i++) {
+  Lander_Stage *st = &LANDER_STAGES[i];
+  printf("%-9s %3d/%d  %-10ld %8.2f %9.1f %5.1f%%\n", st->name, st->period, st->offset, st->runs,
+         st->runs ? st->total / st->runs * 1e6 : 0, st->worst * 1e6,
+         LANDER_TICK.total > 0 ? 100 * st->total / LANDER_TICK.total : 0);
+ }
+ printf("tick               %-10ld %8.2f %9.1f\n", LANDER_TICK.runs,
+        LANDER_TICK.runs ? LANDER_TICK.total / LANDER_TICK.runs * 1e6 : 0, LANDER_TICK.worst * 1e6);
+ printf("%ld ticks over the %.0f ms deadline\n", LANDER_TICK.misses, STAGE_DEADLINE * 1e3);
+ printf("safety %s: %ld of %ld ticks skipped (%.1f%%), %ld bounds dropped, stepped in on %ld\n",
+        SAFETY_LAZY ? "lazy" : "full", SAFETY_STATS.skipped, SAFETY_STATS.ticks,
+        SAFETY_STATS.ticks ? 100.0 * SAFETY_STATS.skipped / SAFETY_STATS.ticks : 0,
+        SAFETY_STATS.rearms, SAFETY_STATS.acted);
+}
+
+void Lander_Control(void)
+{
+ Control_Tick(1);
+}
+
+// Lander_Control() with the position history dead reckoned from the
+// last one instead of averaged from POSITION_SAMPLES readings, which is
+// nearly all of what a tick costs. For the simulator's accelerated mode
+// (SIM_ACCEL in Lander_Sim.h), which only asks for it for a few ticks at
+// a time and away from terrain.
+void Lander_Coast(void)
+{
+ Control_Tick(0);
+}
+
+// Picks the policy once, from the LANDER_POLICY environment variable:
+// "live" (default) runs Lander_Control_M/R/L, "table" looks commands up
+// in the table from LANDER_POLICY_TABLE (default policy_table.bin) and
+// runs them only where the table can't answer (Policy_Table_Lookup()),
+// "plan" flies the trajectory planner.
+void Policy_Select(void){
+  static int selected = 0;
+  char *p, *name;
+
+  if (selected) return;
+  selected = 1;
+  p = getenv("LANDER_SAFETY");
+  if (p && !strcmp(p, "full")) SAFETY_LAZY = 0;
+  name = getenv("LANDER_PARAMS");
+  if (name && !Lander_Params_Load(name, &LANDER_PARAMS))
+    fprintf(stderr, "Unable to load parameters %s, using defaults\n", name);
+  p = getenv("LANDER_POLICY");
+  if (p && !strcmp(p, "plan")) POLICY_MODE = POLICY_PLAN;
+  if (!p || strcmp(p, "table")) return;
+  name = getenv("LANDER_POLICY_TABLE");
+  if (!name) name = (char *)"policy_table.bin";
+  if (Policy_Table_Load(name)) POLICY_MODE = POLICY_TABLE;
+  else fprintf(stderr, "Unable to load policy table %s, using live policy\n", name);
+}
+
+// Parameter files hold "name value" lines, # starts a comment. Values
+// not in the file keep what *p had. Nothing is changed if the file has
+// a name that isn't one of LP_NAMES.
+int Lander_Params_Load(const char *name, Lander_Params *p){
+  FILE *f = fopen(name, "r");
+  Lander_Params q = *p;
+  double *v = (double *)&q;
+  char line[256], key[64];
+  double value;
+  int i;
+
+  if (!f) return 0;
+  while (fgets(line, sizeof(line), f)){
+    if (sscanf(line, " %63s %lf", key, &value) != 2 || key[0] == '#') continue;
+    for (i = 0; i < LP_N && strcmp(key, LP_NAMES[i]); i++);
+    if (i == LP_N){
+      fprintf(stderr, "%s: unknown parameter %s\n", name, key);
+      fclose(f);
+      return 0;
+    }
+    v[i] = value;
+  }
+  fclose(f);
+  *p = q;
+  return 1;
+}
+
+int Lander_Params_Save(const char *name, const Lander_Params *p){
+  FILE *f = fopen(name, "w");
+  const double *v = (const double *)p;
+
+  if (!f) return 0;
+  for (int i = 0; i < LP_N; i++) fprintf(f, "%-18s %g\n", LP_NAMES[i], v[i]);
+  fclose(f);
+  return 1;
+}
+
+// The nodes are unevenly spaced, a uniform bucket array per dimension
+// gives the cell of the bucket's lower edge so finding the cell of a
+// value is one load plus at most a step or two
+#define PT_NBUCKET 256
+static unsigned char pt_bucket[4][PT_NBUCKET];
+
+static void Grid_Buckets(const double *node, int n, unsigned char *bucket){
+  double step = (node[n - 1] - node[0]) / PT_NBUCKET;
+  int i = 0;
+
+  for (int k = 0; k < PT_NBUCKET; k++){
+    while (i < n - 2 && node[0] + k * step >= node[i + 1]) i++;
+    bucket[k] = i;
+  }
+}
+
+int Policy_Table_Load(const char *name){
+  FILE *f;
+  char magic[8];
+  int dims[6];
+  size_t n = (size_t)PT_NTHR * PT_CELLS * PT_LINE;
+
+  f = fopen(name, "rb");
+  if (!f) return 0;
+  if (fread(magic, 1, 8, f) != 8 || memcmp(magic, "LPTABL2", 8) ||
+      fread(dims, sizeof(int), 6, f) != 6 ||
+      dims[0] != PT_NDX || dims[1] != PT_NDY || dims[2] != PT_NVX ||
+      dims[3] != PT_NVY || dims[4] != PT_NANG || dims[5] != PT_LINE){
+    fclose(f);
+    return 0;
+  }
+  free(policy_table);
+  // Each node's angle bins fill half a cache line, keep them from
+  // straddling two
+  policy_table = (PT_Entry *)aligned_alloc(64, n * sizeof(PT_Entry));
+  if (!policy_table || fread(policy_table, sizeof(PT_Entry), n, f) != n){
+    free(policy_table);
+    policy_table = NULL;
+    fclose(f);
+    return 0;
+  }
+  fclose(f);
+  Grid_Buckets(PT_DX_NODES, PT_NDX, pt_bucket[0]);
+  Grid_Buckets(PT_DY_NODES, PT_NDY, pt_bucket[1]);
+  Grid_Buckets(PT_VX_NODES, PT_NVX, pt_bucket[2]);
+  Grid_Buckets(PT_VY_NODES, PT_NVY, pt_bucket[3]);
+  return 1;
+}
+
+// Index of the grid cell holding v and the fractional position in it,
+// clamped to the grid
+static double Grid_Index(double v, const double *node, int n, const unsigned char *bucket, int *i){
+  int k;
+
+  if (v <= node[0]){ *i = 0; return 0; }
+  if (v >= node[n - 1]){ *i = n - 2; return 1; }
+  k = (int)((v - node[0]) * PT_NBUCKET / (node[n - 1] - node[0]));
+  *i = bucket[k < PT_NBUCKET ? k : PT_NBUCKET - 1];
+  while (*i < n - 2 && v >= node[*i + 1]) (*i)++;
+  return (v - node[*i]) / (node[*i + 1] - node[*i]);
+}
+
+// The resolved bits of a cell sit in the line's spare slot
+static_assert(PT_MASK < PT_LINE && PT_NANG <= 16, "a node's line holds its angle bins and the cell's mask");
+
+// Thrust power and target angle of the nearest node. thr is 0 main,
+// 1 right, 2 left. Returns 0, leaving the state to the live policy, off
+// the grid and in cells the policy switches inside of, which Policy_Gen
+// has marked per angle bin. Within the others the 16 nodes either side
+// of ang agree on the target and within PT_SPREAD on the thrust, so the
+// nearest one stands for the cell and one line, two at most, is read.
+int Policy_Table_Lookup(int thr, double dx, double dy, double vx, double vy,
+                        double ang, double *power, double *target){
+  const int sy = PT_NVX * PT_NVY * PT_LINE, sx = PT_NDY * sy;
+  const int svx = PT_NVY * PT_LINE, svy = PT_LINE;
+  int ix, iy, ivx, ivy, ia, ib, near;
+  double fx, fy, fvx, fvy;
+  const PT_Entry *e;
+
+  if (!policy_table) return 0;
+  // A NaN would pass the range test and index the buckets with garbage
+  if (!isfinite(dx) || !isfinite(dy) || !isfinite(vx) || !isfinite(vy) || !isfinite(ang))
+    return 0;
+  if (dx < PT_DX_NODES[0] || dx > PT_DX_NODES[PT_NDX - 1] ||
+      dy < PT_DY_NODES[0] || dy > PT_DY_NODES[PT_NDY - 1] ||
+      vx < PT_VX_NODES[0] || vx > PT_VX_NODES[PT_NVX - 1] ||
+      vy < PT_VY_NODES[0] || vy > PT_VY_NODES[PT_NVY - 1])
+    return 0;
+  fx = Grid_Index(dx, PT_DX_NODES, PT_NDX, pt_bucket[0], &ix);
+  fy = Grid_Index(dy, PT_DY_NODES, PT_NDY, pt_bucket[1], &iy);
+  fvx = Grid_Index(vx, PT_VX_NODES, PT_NVX, pt_bucket[2], &ivx);
+  fvy = Grid_Index(vy, PT_VY_NODES, PT_NVY, pt_bucket[3], &ivy);
+  while (ang < 0) ang += 360;
+  ib = (int)(ang * PT_NANG / 360.0) % PT_NANG;
+
+  e = policy_table + (size_t)thr * PT_CELLS * PT_LINE +
+      ix * sx + iy * sy + ivx * svx + ivy * svy;
+  if (!((e[PT_MASK].power | e[PT_MASK].target << 8) >> ib & 1)) return 0;
+
+  ia = (int)(ang * PT_NANG / 360.0 + .5) % PT_NANG;
+  near = (fx > .5) * sx + (fy > .5) * sy + (fvx > .5) * svx + (fvy > .5) * svy + ia;
+  *power = e[near].power / 255.0;
+  *target = e[near].target * 360.0 / 256.0;
+  return 1;
+}
+
+int Policy_Table_Control(void){
+  int thr;
+  double power, target, rel, ang = Robust_Ang();
+
+  if (MT_OK) thr = 0;
+  else if (RT_OK) thr = 1;
+  else if (LT_OK) thr = 2;
+  else return 0;
+  if (!Policy_Table_Lookup(thr, Robust_PX() - PLAT_X, PLAT_Y - Robust_PY(),
+                           Robust_VX(), Robust_VY(), ang, &power, &target)) return 0;
+
+  if (thr == 0) Robust_MT(power);
+  else if (thr == 1) Robust_RT(power);
+  else Robust_LT(power);
+
+  rel = fmod(target - ang + 540, 360) - 180;
+  if (fabs(rel) > 1) Robust_Rot(rel);
+  return 1;
+}
+
+void Occupancy_Reset(void){
+  memset(occ_used, 0, sizeof(occ_used));
+  occ_tick = 0;
+  for (int i = 0; i < 36; i++) occ_last[i] = occ_ring[i] = occ_held[i] = -1;
+}
+
+// Cells of the tile at tile position (tx, ty), NULL if it isn't held
+// and make is 0. A new tile takes the least recently used slot of its
+// probe window, so memory stays bounded and what gets forgotten is
+// terrain we haven't been near in a while.
+static unsigned char *Occupancy_Tile(int tx, int ty, int make){
+  int h = ((unsigned)tx * 73856093u ^ (unsigned)ty * 19349663u) & (OCC_TILES - 1), slot = h, k;
+
+  for (int i = 0; i < OCC_PROBE; i++){
+    k = (h + i) & (OCC_TILES - 1);
+    if (occ_used[k] && occ_tx[k] == tx && occ_ty[k] == ty){
+      occ_used[k] = occ_tick;
+      return occ_cell[k];
+    }
+    if (occ_used[k] < occ_used[slot]) slot = k;
+  }
+  if (!make) return NULL;
+  memset(occ_cell[slot], 0, sizeof(occ_cell[slot]));
+  occ_tx[slot] = tx;
+  occ_ty[slot] = ty;
+  occ_used[slot] = occ_tick;
+  return occ_cell[slot];
+}
+
+// Cell index of world coordinate v (px). Truncating from a large
+// positive offset floors without a call to floor(), positions above the
+// top of the map included, and the shifts below floor negatives too.
+static inline int Occupancy_Index(double v){
+  return (int)(v * (1.0 / OCC_CELL) + 65536) - 65536;
+}
+
+// Evidence count of the cell holding world point (x, y) px, creating
+// its tile if asked to
+static unsigned char *Occupancy_Cell(double x, double y, int make){
+  int cx = Occupancy_Index(x), cy = Occupancy_Index(y);
+  unsigned char *t = Occupancy_Tile(cx >> OCC_SHIFT, cy >> OCC_SHIFT, make);
+
+  return t ? t + (cy & (OCC_TILE - 1)) * OCC_TILE + (cx & (OCC_TILE - 1)) : NULL;
+}
+
+// Distance (px) from (x, y) along world direction dir (degrees clockwise
+// from up) to the first occupied cell, -1 if there is none within range.
+// Marches in half cells so corners aren't stepped over, fetching a tile
+// only when the march crosses into it and jumping straight across tiles
+// that aren't held, which is most of the open air.
+double Occupancy_Clearance(double x, double y, double dir, double range){
+  double sx = sin(dir * PI / 180), sy = -cos(dir * PI / 180), px, py, ex, ey;
+  double side = OCC_CELL * OCC_TILE;
+  int cx, cy, tx, ty;
+  unsigned char *t;
+
+  for (double r = 0; r <= range;){
+    px = x + r * sx;
+    py = y + r * sy;
+    cx = Occupancy_Index(px);
+    cy = Occupancy_Index(py);
+    tx = cx >> OCC_SHIFT;
+    ty = cy >> OCC_SHIFT;
+    t = Occupancy_Tile(tx, ty, 0);
+    if (!t){
+      ex = sx > 0 ? ((tx + 1) * side - px) / sx : sx < 0 ? (tx * side - px) / sx : range;
+      ey = sy > 0 ? ((ty + 1) * side - py) / sy : sy < 0 ? (ty * side - py) / sy : range;
+      r += fmin(ex, ey) + .01;
+      continue;
+    }
+    // Inside a held tile, step cells until the march leaves it
+    for (; r <= range; r += OCC_CELL / 2){
+      cx = Occupancy_Index(x + r * sx);
+      cy = Occupancy_Index(y + r * sy);
+      if (cx >> OCC_SHIFT != tx || cy >> OCC_SHIFT != ty) break;
+      if (t[(cy & (OCC_TILE - 1)) * OCC_TILE + (cx & (OCC_TILE - 1))] >= OCC_SEEN) return r;
+    }
+  }
+  return -1;
+}
+
+// Pulls the position estimate (x, y) px back onto the map when a
+// position sensor is gone, so dead reckoning doesn't drift off for the
+// rest of the descent. The returns new this tick are placed from the
+// estimate, then shifted over a grid of offsets in the axes whose
+// sensor is broken, and each offset scores the returns that land on
+// occupied cells. The estimate moves part of the way to the middle of
+// the best scoring offsets: returns off a flat surface score the same
+// all along it, so a direction the scan can't pin down averages out to
+// no correction at all. Must run before Occupancy_Update() puts the
+// same returns in the map.
+void Scan_Match(double *x, double *y, double ang){
+  double px[36], py[36], a, sx = 0, sy = 0;
+  int n = 0, best = 0, ties = 0, score;
+  int wx = POSITION_X_OK || VELOCITY_X_OK ? 0 : SCAN_WINDOW;
+  int wy = POSITION_Y_OK || VELOCITY_Y_OK ? 0 : SCAN_WINDOW;
+  unsigned char *c;
+
+  for (int i = 0; i < 36; i++){
+    if (SONAR_CLEAN[i] <= -1 || SONAR_CLEAN[i] == occ_last[i]) continue;
+    a = (ang + 10 * i) * PI / 180;
+    px[n] = *x + SONAR_CLEAN[i] * sin(a);
+    py[n] = *y - SONAR_CLEAN[i] * cos(a);
+    n++;
+  }
+  if (!n) return;
+
+  for (int oy = -wy; oy <= wy; oy += SCAN_STEP)
+    for (int ox = -wx; ox <= wx; ox += SCAN_STEP){
+      score = 0;
+      for (int k = 0; k < n; k++){
+        c = Occupancy_Cell(px[k] + ox, py[k] + oy, 0);
+        score += c && *c >= OCC_SEEN;
+      }
+      if (score > best){
+        best = score;
+        ties = 0;
+        sx = sy = 0;
+      }
+      if (score == best){
+        ties++;
+        sx += ox;
+        sy += oy;
+      }
+    }
+  if (!best) return;
+  *x += SCAN_GAIN * sx / ties;
+  *y += SCAN_GAIN * sy / ties;
+  // An offset that keeps coming back is a velocity error
+  mv_vx += SCAN_VGAIN * sx / ties / S_SCALE;
+  mv_vy -= SCAN_VGAIN * sy / ties / S_SCALE;
+}
+
+// Feeds the map from the pose estimate. A ray's reading only changes
+// when a new ping hits something, so only those go in: O(rays) per
+// tick. The ring of clearances the planner and its override look at is
+// then the nearer of the current return and what the map remembers
+// along each ray, which covers terrain that has dropped out of the
+// current ping (behind us, or passed over). What the map remembers
+// changes slowly, so each tick only every OCC_STRIDE'th ray marches the
+// map again and the others keep their last answer.
+void Occupancy_Update(double x, double y, double ang){
+  double a, m;
+  unsigned char *c;
+
+  occ_tick++;
+  for (int i = 0; i < 36; i++){
+    a = (ang + 10 * i) * PI / 180;
+    if (SONAR_CLEAN[i] > -1 && SONAR_CLEAN[i] != occ_last[i]){
+      c = Occupancy_Cell(x + SONAR_CLEAN[i] * sin(a), y - SONAR_CLEAN[i] * cos(a), 1);
+      if (*c < 255) (*c)++;
+    }
+    occ_last[i] = SONAR_CLEAN[i];
+    if (i % OCC_STRIDE == occ_tick % OCC_STRIDE)
+      occ_held[i] = Occupancy_Clearance(x, y, ang + 10 * i, SONAR_CLEAN[i] > -1 ? fmin(OCC_RANGE, SONAR_CLEAN[i]) : OCC_RANGE);
+    m = occ_held[i];
+    occ_ring[i] = SONAR_CLEAN[i] <= -1 || (m >= 0 && m < SONAR_CLEAN[i]) ? m : SONAR_CLEAN[i];
+  }
+}
+
+// Closest obstacle (m) within +-30 degrees of the world direction dir
+// (degrees clockwise from up), -1 if nothing in range. Read off the
+// occupancy ring, which turns with the lander, ang is its attitude.
+static double Plan_Clearance(double ang, double dir){
+  double d = -1, a;
+
+  for (int i = 0; i < 36; i++){
+    if (occ_ring[i] <= -1) continue;
+    a = fmod(ang + 10 * i - dir + 540, 360) - 180;
+    if (fabs(a) <= 30 && (d < 0 || occ_ring[i] / S_SCALE < d)) d = occ_ring[i] / S_SCALE;
+  }
+  return d;
+}
+
+// Thrust allocation. Finds the power for every working thruster (main,
+// right, left) whose summed acceleration at attitude ang comes closest
+// to (tx, ty) m/s^2: a 2x3 least-squares problem with each power boxed
+// to [0 1]. Solved by projected coordinate descent, two of the three
+// columns are antiparallel so a few sweeps settle it.
+void Thrust_Allocate(double tx, double ty, double ang, double *power){
+  double b[3][2], rx = tx, ry = ty, a, p;
+  int ok[3] = {MT_OK, RT_OK, LT_OK};
+  double accel[3] = {MT_ACCEL, RT_ACCEL, LT_ACCEL};
+  double offset[3] = {0, -90, 90};
+
+  for (int i = 0; i < 3; i++){
+    a = (ang + offset[i]) * PI / 180;
+    b[i][0] = accel[i] * (1 - NP1) * sin(a);
+    b[i][1] = accel[i] * (1 - NP1) * cos(a);
+    power[i] = 0;
+  }
+  for (int sweep = 0; sweep < ALLOC_SWEEPS; sweep++)
+    for (int i = 0; i < 3; i++){
+      if (!ok[i]) continue;
+      rx += b[i][0] * power[i];
+      ry += b[i][1] * power[i];
+      p = (b[i][0] * rx + b[i][1] * ry) / (b[i][0] * b[i][0] + b[i][1] * b[i][1]);
+      power[i] = fmax(0, fmin(1, p));
+      rx -= b[i][0] * power[i];
+      ry -= b[i][1] * power[i];
+    }
+}
+
+// Near time-optimal planner. Every tick it re-solves the braking curves
+// from the current state: the fastest vertical and horizontal velocity
+// from which the lander can still stop at the platform (or short of the
+// terrain the sonar sees) with PLAN_MARGIN of the spare thrust. The
+// difference to the current velocity gives the acceleration wanted,
+// which is turned into a thrust direction and power for whichever
+// thruster is left. Constant time per tick, nothing carried over.
+int Plan_Control(void){
+  int thr;
+  double accel, offset, a_v, a_h, dx, h, h_eff, below, side, vx, vy;
+  double vx_des, vy_des, tx, ty, t, dir, err, power[3], speed, ahead, k, lateral;
+  double ang = Robust_Ang();
+
+  if (MT_OK){ thr = 0; accel = MT_ACCEL; offset = 0; }
+  else if (RT_OK){ thr = 1; accel = RT_ACCEL; offset = 90; }
+  else if (LT_OK){ thr = 2; accel = LT_ACCEL; offset = -90; }
+  else return 0;
+  accel *= 1 - NP1;
+
+  // Everything in metres, up and right positive. The position comes
+  // from the averaged reading Setting_Up_Arrays() just took, a single
+  // reading is metres off this close to the bottom of the map.
+  dx = (PLAT_X - POS_X[0]) / S_SCALE;
+  h = (PLAT_Y - POS_Y[0] - 16) / S_SCALE;   // 16 px from centre to gear
+  vx = Robust_VX();
+  vy = Robust_VY();
+  a_v = PLAN_MARGIN * (accel - G_ACCEL);
+  a_h = PLAN_MARGIN * sqrt(accel * accel - G_ACCEL * G_ACCEL);
+  // Both side thrusters working: either can brake sideways on top of a
+  // tilted main thruster
+  if (!thr && RT_OK && LT_OK) a_h += PLAN_MARGIN * fmin(RT_ACCEL, LT_ACCEL) * (1 - NP1);
+
+  // Horizontal: fastest approach that can still stop over the platform,
+  // slowed down if the sonar sees terrain ahead
+  vx_des = sqrt(2 * a_h * fmax(0, fabs(dx) - 1));
+  side = Plan_Clearance(ang, dx > 0 ? 90 : 270);
+  if (side >= 0) vx_des = fmin(vx_des, sqrt(2 * a_h * fmax(0, side - PLAN_CLEARANCE)));
+  if (dx < 0) vx_des = -vx_des;
+
+  // Vertical: descend only as far as the glide slope towards the
+  // platform and the terrain below allow until lined up over it
+  if (fabs(dx) > 4){
+    h_eff = h - (fabs(dx) - 4);
+    below = Plan_Clearance(ang, 180);
+    if (below >= 0) h_eff = fmin(h_eff, below - PLAN_CLEARANCE);
+    vy_des = h_eff > 0 ? 1 - sqrt(1 + 2 * a_v * h_eff) : fmin(5, -h_eff);
+  }
+  else vy_des = -sqrt(PLAN_V_TD * PLAN_V_TD + 2 * a_v * fmax(0, h));
+
+  // Terrain in the way: climb over it, and don't close in on whatever
+  // lies along the velocity faster than we could stop
+  if (fabs(dx) > 4){
+    if (side >= 0 && side < 2 * PLAN_CLEARANCE) vy_des = fmax(vy_des, 5);
+    speed = sqrt(vx * vx + vy * vy);
+    ahead = speed > 1 ? Plan_Clearance(ang, atan2(vx, vy) * 180 / PI) : -1;
+    if (ahead >= 0){
+      k = sqrt(2 * fmin(a_h, a_v) * fmax(0, ahead - PLAN_CLEARANCE)) / speed;
+      if (k < 1){
+        if (fabs(vx * k) < fabs(vx_des)) vx_des = vx * k;
+        if (vy < 0) vy_des = fmax(vy_des, vy * k);
+        else vy_des = fmin(vy_des, vy * k);
+      }
+    }
+  }
+
+  // Track the curves: the braking they call for when on them, plus a
+  // correction for being off them
+  tx = PLAN_GAIN * (vx_des - vx);
+  if (vx_des != 0 && vx / vx_des > 0) tx -= a_h * fmin(1, vx / vx_des) * (dx > 0 ? 1 : -1);
+  ty = PLAN_GAIN * (vy_des - vy) + G_ACCEL;
+  if (vy_des < 0 && vy < 0) ty += a_v * fmin(1, vy / vy_des);
+
+  // With the main thruster, whatever sideways push the side thrusters
+  // give while upright needs no tilt
+  lateral = thr ? 0 : (tx > 0 ? LT_OK * LT_ACCEL : RT_OK * RT_ACCEL) * (1 - NP1);
+
+  // Flare: come upright for touchdown. The side thrusters push
+  // sideways when upright, they only cut out for the last fraction of a
+  // second it takes to turn.
+  if (fabs(dx) <= 4){
+    if (thr && h < .5 + PLAN_FLARE_T * fabs(vy)) tx = ty = 0;
+    else if (!thr && h < PLAN_FLARE_H){
+      t = ty * tan(10 * PI / 180) + lateral;
+      tx = fmax(-t, fmin(t, tx));
+    }
+  }
+
+  if (ty < 0) ty = 0;
+  if (ty > accel){ ty = accel; tx = fmax(-lateral, fmin(lateral, tx)); }
+  t = sqrt(accel * accel - ty * ty) + lateral;
+  tx = fmax(-t, fmin(t, tx));
+
+  // Attitude for the thrust direction, upright when there is nothing
+  // to push for
+  t = tx > 0 ? fmax(0, tx - lateral) : fmin(0, tx + lateral);
+  if (sqrt(t * t + ty * ty) <= .5) dir = 0;
+  else dir = atan2(t, ty) * 180 / PI + offset;
+  err = fmod(dir - ang + 540, 360) - 180;
+  if (fabs(err) > PLAN_DEADBAND) Robust_Rot(err);
+
+  // Share the thrust out over every thruster that works, for the
+  // attitude we are at now
+  Thrust_Allocate(tx, ty, ang, power);
+  Robust_MT(power[0]);
+  Robust_RT(power[1]);
+  Robust_LT(power[2]);
+
+  // What Safety_Override_P() rolls out as the nominal command, and
+  // from which state. Handing over the state also keeps the override
+  // from drawing a second set of sensor samples.
+  plan_state[0] = POS_X[0];
+  plan_state[1] = POS_Y[0];
+  plan_state[2] = vx;
+  plan_state[3] = vy;
+  plan_state[4] = ang;
+  plan_dir = fabs(err) > PLAN_DEADBAND ? dir : ang;
+  for (int i = 0; i < 3; i++) plan_power[i] = power[i];
+  return 1;
 }
 
 double Robust_VX(void){
@@ -381,11 +1462,35 @@ double Robust_PY(void){
 }
 
 double Robust_Ang(void){
-  return Angle();
+  return Angle_alt();
+}
+
+
+// The thrusters, with the command kept for Motion_Update()
+void Robust_MT(double power){
+    cmd_count++;
+    mv_power[0] = power;
+    Main_Thruster(power);
 }
 
+void Robust_RT(double power){
+    cmd_count++;
+    mv_power[1] = power;
+    Right_Thruster(power);
+}
+
+void Robust_LT(double power){
+    cmd_count++;
+    mv_power[2] = power;
+    Left_Thruster(power);
+}
 
 void Robust_Rot(double ang){
+    // What the rotation noise makes of the command on average (it
+    // scales it by 1 - NP2 and adds up to NP2 degrees), for the
+    // heading estimate
+    ae_pend = (1 - NP2) * ang + NP2 / 2;
+    cmd_count++;
     Rotate(ang);
 }
 void Rotate_to(double from, double to){
@@ -407,136 +1512,218 @@ void Rotate_to(double dest){
 }
 
 
-void Lander_Control_R(void){
-  double VXlim;
-	double VYlim;
-
-  if(Robust_PX() - PLAT_X < -20) VXlim = 10; // If lander on the left of platform
-	else if (Robust_PX()-PLAT_X>200) VXlim=15;
- 	else if (Robust_PX()-PLAT_X>100) VXlim=10;
-  else VXlim = 5;
-	//else if (Robust_PX() -PLAT_X > 20)VXlim=5;
-  //else VXlim = 0;
-
- 	if (PLAT_Y-Robust_PY()>200) VYlim=-16;
- 	else if (PLAT_Y-Robust_PY()>100) VYlim=-7;  // These are negative because they
- 	else VYlim=-2;
-
-  if(Robust_VX() - PLAT_X < -20){
-      VXlim = 5;
-  }
-
-
-	if (fabs(PLAT_X-Robust_PX())/fabs(Robust_VX())>1.25*fabs(PLAT_Y-Robust_PY())/fabs(Robust_VY())){ VYlim=0; VXlim=0;}
+// Right thruster policy, one handler per mission phase (Phase_Band()).
+// The horizontal speed limit is vx_lim[1][3] in every phase: the band
+// the policy used to pick was always replaced by it, the test guarding
+// that compared the velocity against PLAT_X.
 
+// Descent speed, lander upright. Descent stops while the lander would
+// come down beside the platform, unless it is known to be above it.
+// Returns 1 if that took the tick.
+static int Control_R_Vertical(const Lander_Params *lp, double dx, double dy, double VYlim, double *VXlim, int above){
+  if (!above && fabs(dx)/fabs(Robust_VX())>lp->over_ratio*fabs(dy)/fabs(Robust_VY())){ VYlim=0; *VXlim=0;}
   if(Robust_VY()<VYlim){
-         
-         Right_Thruster(1);
-         if(fabs(PLAT_X-Robust_PX()) < 40 && fabs(PLAT_Y-Robust_PY())<30){Right_Thruster(0); return;}
+         Robust_RT(1);
+         if(fabs(dx) < lp->cut_dx && fabs(dy)<lp->cut_dy){Robust_RT(0); return 1;}
          if(Robust_Ang() < 89 || Robust_Ang() > 91){
           if(Robust_Ang() < 270) Robust_Rot(90-Robust_Ang());
           else Robust_Rot(450-Robust_Ang());
-          return;
          }
-         else Right_Thruster(1);
-         return;
- }
- else{
-         Right_Thruster(0);
- }
-  if((Robust_PX() - PLAT_X)> -20 && (Robust_PX() - PLAT_X) < 25 && fabs(Robust_PY() - PLAT_Y)>200) return;
- else if(Robust_PX() - PLAT_X > 0 && Robust_PX() - PLAT_X < 15) return;
- 
-if ((Robust_PX()-PLAT_X>15) && Robust_VX() > -VXlim)
+         return 1;
+  }
+  Robust_RT(0);
+  return 0;
+}
+
+// Toward the platform while slower than VXlim, upright otherwise
+static void Control_R_Side(const Lander_Params *lp, double dx, double VXlim){
+ if (dx>lp->side_dx[1][0] && Robust_VX() > -VXlim)
  {  
-    if(Robust_VX() < 0){Right_Thruster(0); return;}
-    Right_Thruster((VXlim+fmin(0,Robust_VX())));
+    if(Robust_VX() < 0){Robust_RT(0); return;}
+    Robust_RT((VXlim+fmin(0,Robust_VX())));
     if(Robust_Ang() < 359 && Robust_Ang() > 1){
-        
-		if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
+	if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
     else Robust_Rot(-Robust_Ang());
-    printf("Putar 1\n");
     return;
   }
  }
  // Left of plat
- else if((PLAT_X-Robust_PX() > 15) && Robust_VX() < VXlim)
+ else if(-dx > lp->side_dx[1][1] && Robust_VX() < VXlim)
  {
-    
-    if(Robust_VX() > 0){Right_Thruster(0);return;}
-    Right_Thruster((VXlim-fmax(0,Robust_VX())));
+    if(Robust_VX() > 0){Robust_RT(0);return;}
+    Robust_RT((VXlim-fmax(0,Robust_VX())));
     if(Robust_Ang() < 179 || Robust_Ang() > 181){
     Robust_Rot(180-Robust_Ang());
-    ("Putar 2\n");
     return;
  }
 } 
- else Right_Thruster(0);
+ else Robust_RT(0);
          if(Robust_Ang() < 89 || Robust_Ang() > 91){
           if(Robust_Ang() < 270) Robust_Rot(90-Robust_Ang());
           else Robust_Rot(450-Robust_Ang());
          }
+}
+
+// Cruise and traverse: over 90 px to the side, any height
+static void Control_R_Far(void){
+  const Lander_Params *lp = &LANDER_PARAMS;
+  double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY(), VXlim = lp->vx_lim[1][3];
 
+  if (Control_R_Vertical(lp, dx, dy, dy > 200 ? lp->vy_lim[1][0] : dy > 100 ? lp->vy_lim[1][1] : lp->vy_lim[1][2], &VXlim, 0)) return;
+  Control_R_Side(lp, dx, VXlim);
 }
 
-void Lander_Control_L(void){
-	double VXlim;
-	double VYlim;
+// Align: over 190 px up. Over the platform: coast down the column, hold
+// close in
+static void Control_R_Align(void){
+  const Lander_Params *lp = &LANDER_PARAMS;
+  double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY(), VXlim = lp->vx_lim[1][3];
+
+  if (Control_R_Vertical(lp, dx, dy, dy > 200 ? lp->vy_lim[1][0] : lp->vy_lim[1][1], &VXlim, 0)) return;
+  if (dx > -lp->column_l && dx < lp->column_r) return;
+  if (dx > 0 && dx < lp->hold_dx[1]) return;
+  Control_R_Side(lp, dx, VXlim);
+}
+
+// Descent: within 110 px, at most 210 px up. In the hold, either side
+// of the platform, straight down. Outside it, push toward the platform
+// from still or drifting away, else coast upright.
+static void Control_R_Descent(void){
+  const Lander_Params *lp = &LANDER_PARAMS;
+  double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY(), VXlim;
+  int hold = fabs(dx) < lp->hold_dx[1];
+
+  if (Control_R_Vertical(lp, dx, dy, dy > 100 ? lp->vy_lim[1][1] : lp->vy_lim[1][2], &VXlim, hold)) return;
+  if (hold) return;
+  if ((dx > 0 ? Robust_VX() : -Robust_VX()) >= 0){
+    Robust_RT(1);
+    if (dx > 0 && Robust_Ang() < 359 && Robust_Ang() > 1){
+      if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
+      else Robust_Rot(-Robust_Ang());
+    }
+    else if (dx <= 0 && (Robust_Ang() < 179 || Robust_Ang() > 181)) Robust_Rot(180-Robust_Ang());
+    return;
+  }
+  if(Robust_Ang() < 89 || Robust_Ang() > 91){
+    if(Robust_Ang() < 270) Robust_Rot(90-Robust_Ang());
+    else Robust_Rot(450-Robust_Ang());
+  }
+}
 
-	if (fabs(Robust_PX()-PLAT_X)>200) VXlim=10;
- 	else if (fabs(Robust_PX()-PLAT_X)>100) VXlim=15;
-	else if (fabs(Robust_PX() - PLAT_X) > 40) VXlim=10;
-  else VXlim = 5;
+static void (*const CONTROL_R_PHASES[PHASE_N])(void) = {
+  Control_R_Far, Control_R_Far, Control_R_Align, Control_R_Descent
+};
 
- 	if (PLAT_Y-Robust_PY()>200) VYlim=-16;
- 	else if (PLAT_Y-Robust_PY()>100) VYlim=-7;  // These are negative because they
- 	else VYlim=-2;
+void Lander_Control_R(void){
+  CONTROL_R_PHASES[Phase_Band()]();
+}
 
+// Left thruster policy, one handler per mission phase
 
-	if (fabs(PLAT_X-Robust_PX())/fabs(Robust_VX())>1.25*fabs(PLAT_Y-Robust_PY())/fabs(Robust_VY())){ VYlim=0;VXlim=0;}
-//if(fabs(Robust_PY() - PLAT_Y) < 25 && fabs(Robust_PX() - PLAT_X) < 30) return;
+// Descent speed, lander upright, as for the right thruster
+static int Control_L_Vertical(const Lander_Params *lp, double dx, double dy, double VYlim, double *VXlim, int above){
+	if (!above && fabs(dx)/fabs(Robust_VX())>lp->over_ratio*fabs(dy)/fabs(Robust_VY())){ VYlim=0; *VXlim=0;}
   if(Robust_VY()<VYlim){
-         Left_Thruster(1);
-         if(fabs(PLAT_X-Robust_PX()) < 40 && fabs(PLAT_Y-Robust_PY())<30){Left_Thruster(0);return;}
+         Robust_LT(1);
+         if(fabs(dx) < lp->cut_dx && fabs(dy)<lp->cut_dy){Robust_LT(0);return 1;}
          if(Robust_Ang() < 269 || Robust_Ang() > 271){
           if(Robust_Ang() > 90) Robust_Rot(270-Robust_Ang());
           else Robust_Rot(-90-Robust_Ang());
-          return;
          }
-         else Left_Thruster(1);
-         return;
- }
- else{
-         Left_Thruster(0);
- }
-  if((Robust_PX() - PLAT_X)> -20 && (Robust_PX() - PLAT_X) < 25 && fabs(Robust_PY() - PLAT_Y)>200) return;
- else if(fabs(Robust_PX() - PLAT_X) < 15) return;
- 
-if ((Robust_PX()-PLAT_X>20) && Robust_VX() > -VXlim)
+         return 1;
+  }
+  Robust_LT(0);
+  return 0;
+}
+
+// Toward the platform while slower than VXlim, upright otherwise
+static void Control_L_Side(const Lander_Params *lp, double dx, double VXlim){
+if (dx>lp->side_dx[2][0] && Robust_VX() > -VXlim)
  {
-    if(Robust_VX() < 0){Left_Thruster(0); return;}
-    Left_Thruster(1);
+    if(Robust_VX() < 0){Robust_LT(0); return;}
+    Robust_LT(1);
     if(Robust_Ang() < 179 || Robust_Ang() > 181) Robust_Rot(180-Robust_Ang());
     return;
  }
  // Left of plat
- else if((PLAT_X-Robust_PX() > 15) && Robust_VX() < VXlim)
+ else if(-dx > lp->side_dx[2][1] && Robust_VX() < VXlim)
  {
     
-    if(Robust_VX() > 0){Left_Thruster(0);return;}
-    Left_Thruster(1);
+    if(Robust_VX() > 0){Robust_LT(0);return;}
+    Robust_LT(1);
     if(Robust_Ang() < 359|| Robust_Ang() > 1){
     if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
     else Robust_Rot(-Robust_Ang());
     return;
  }
 } 
- else Left_Thruster(0);
+ else Robust_LT(0);
   if(Robust_Ang() < 269 || Robust_Ang() > 271){
      if(Robust_Ang() > 90) Robust_Rot(270-Robust_Ang());
       else Robust_Rot(-90-Robust_Ang());
   }
+}
+
+// Cruise and traverse: over 90 px to the side, any height
+static void Control_L_Far(double VXlim){
+	const Lander_Params *lp = &LANDER_PARAMS;
+	double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY();
+
+	if (Control_L_Vertical(lp, dx, dy, dy > 200 ? lp->vy_lim[2][0] : dy > 100 ? lp->vy_lim[2][1] : lp->vy_lim[2][2], &VXlim, 0)) return;
+	Control_L_Side(lp, dx, VXlim);
+}
 
+static void Control_L_Cruise(void){
+	Control_L_Far(LANDER_PARAMS.vx_lim[2][0]);
+}
+
+static void Control_L_Traverse(void){
+	Control_L_Far(LANDER_PARAMS.vx_lim[2][1]);
+}
+
+// Align: over 190 px up. Over the platform: coast down the column, hold
+// close in
+static void Control_L_Align(void){
+	const Lander_Params *lp = &LANDER_PARAMS;
+	double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY();
+	double VXlim = fabs(dx) > 40 ? lp->vx_lim[2][2] : lp->vx_lim[2][3];
+
+	if (Control_L_Vertical(lp, dx, dy, dy > 200 ? lp->vy_lim[2][0] : lp->vy_lim[2][1], &VXlim, 0)) return;
+	if (dx > -lp->column_l && dx < lp->column_r) return;
+	if (fabs(dx) < lp->hold_dx[2]) return;
+	Control_L_Side(lp, dx, VXlim);
+}
+
+// Descent: within 110 px, at most 210 px up. In the hold straight
+// down, outside it as for the right thruster.
+static void Control_L_Descent(void){
+	const Lander_Params *lp = &LANDER_PARAMS;
+	double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY(), VXlim;
+	int hold = fabs(dx) < lp->hold_dx[2];
+
+	if (Control_L_Vertical(lp, dx, dy, dy > 100 ? lp->vy_lim[2][1] : lp->vy_lim[2][2], &VXlim, hold)) return;
+	if (hold) return;
+	if ((dx > 0 ? Robust_VX() : -Robust_VX()) >= 0){
+	  Robust_LT(1);
+	  if (dx > 0 && (Robust_Ang() < 179 || Robust_Ang() > 181)) Robust_Rot(180-Robust_Ang());
+	  else if (dx <= 0 && Robust_Ang() < 359 && Robust_Ang() > 1){
+	    if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
+	    else Robust_Rot(-Robust_Ang());
+	  }
+	  return;
+	}
+	if(Robust_Ang() < 269 || Robust_Ang() > 271){
+	  if(Robust_Ang() > 90) Robust_Rot(270-Robust_Ang());
+	  else Robust_Rot(-90-Robust_Ang());
+	}
+}
+
+static void (*const CONTROL_L_PHASES[PHASE_N])(void) = {
+	Control_L_Cruise, Control_L_Traverse, Control_L_Align, Control_L_Descent
+};
+
+void Lander_Control_L(void){
+	CONTROL_L_PHASES[Phase_Band()]();
 }
 
 
@@ -710,48 +1897,33 @@ void Safety_Override_N(void)
 }
 
 
-void Lander_Control_M(void){
- double VXlim;
- double VYlim;
-
- if(Robust_PX() - PLAT_X < -20) VXlim = 10; 
- else if (fabs(Robust_PX()-PLAT_X)>200) VXlim=15;
- else if (fabs(Robust_PX()-PLAT_X)>100) VXlim=10;
- else VXlim=5;
-
- if (PLAT_Y-Robust_PY()>200) VYlim=-20;
- else if (PLAT_Y-Robust_PY()>100) VYlim=-10;  // These are negative because they
- else VYlim=-4;				       // limit descent velocity
+// Main thruster policy, one handler per mission phase
 
+// Descent speed, lander upright, as for the right thruster
+static int Control_M_Vertical(const Lander_Params *lp, double dx, double dy, double VYlim, int above){
  // Ensure we will be OVER the platform when we land
- if (fabs(PLAT_X-Robust_PX())/fabs(Robust_VX())>1.25*fabs(PLAT_Y-Robust_PY())/fabs(Robust_VY())) VYlim=0;
+ if (!above && fabs(dx)/fabs(Robust_VX())>lp->over_ratio*fabs(dy)/fabs(Robust_VY())) VYlim=0;
  if (Robust_VY()<VYlim){
-  Main_Thruster(1);
+  Robust_MT(1);
   if(Robust_Ang() > 1 && Robust_Ang() < 369){
     if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
     else Robust_Rot(-Robust_Ang());
-    return;
   }
-	else Main_Thruster(1);
-   return;
- }
- else{
-	 Main_Thruster(0);
- }
- //&& fabs(Robust_PY() - PLAT_Y) > 200
- if(fabs(Robust_PX() - PLAT_X ) < 30 ){
-    //Main_Thruster(0);
-   return;
+  return 1;
  }
- else if(fabs(Robust_PX()- PLAT_X) < 20) return;
+ Robust_MT(0);
+ return 0;
+}
 
- //else if(fabs(Robust_PY() - PLAT_Y)< 100) return;
+// Toward the platform on its side while slower than VXlim, upright
+// otherwise
+static void Control_M_Side(const Lander_Params *lp, double dx, double VXlim){
 //Right of plat
- if ((Robust_PX()-PLAT_X>20) && Robust_VX() > -VXlim)
+ if (dx>lp->side_dx[0][0] && Robust_VX() > -VXlim)
  {  
-    if(Robust_VX() < 0){Main_Thruster(0); return;}
+    if(Robust_VX() < 0){Robust_MT(0); return;}
     //Main_Thruster((VXlim+fmin(0,Robust_VX())));
-    Main_Thruster(1);
+    Robust_MT(1);
     if(Robust_Ang() < 269 || Robust_Ang() > 271){
 		if(Robust_Ang() >= 90) Robust_Rot(270-Robust_Ang());
 		else Robust_Rot(-90-Robust_Ang());
@@ -761,12 +1933,12 @@ void Lander_Control_M(void){
   }
  }
  // Left of plat
- else if((PLAT_X-Robust_PX() > 20) && Robust_VX() < VXlim)
+ else if(-dx > lp->side_dx[0][1] && Robust_VX() < VXlim)
  {
 	  //Main_Thruster((VXlim-fmax(0,Robust_VX())));
-    if(Robust_VX() > 0){Main_Thruster(0);return;}
+    if(Robust_VX() > 0){Robust_MT(0);return;}
     //Main_Thruster((VXlim-fmax(0,Robust_VX())));
-    Main_Thruster(1);
+    Robust_MT(1);
     if(Robust_Ang() < 269 || Robust_Ang() > 271){
     if(Robust_Ang() >= 270) Robust_Rot(450-Robust_Ang());
        else Robust_Rot(90-Robust_Ang());
@@ -774,20 +1946,179 @@ void Lander_Control_M(void){
     return;
  }
 } 
- else Main_Thruster(0);
+ else Robust_MT(0);
   if(Robust_Ang() > 1 && Robust_Ang() < 359){
     if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
     else Robust_Rot(-Robust_Ang());
   }
 }
 
-void Safety_Override(void){
+// Cruise and traverse: over 90 px to the side, any height. Tighter
+// speed limit coming from the left.
+static void Control_M_Far(double VXlim){
+ const Lander_Params *lp = &LANDER_PARAMS;
+ double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY();
+
+ if (Control_M_Vertical(lp, dx, dy, dy > 200 ? lp->vy_lim[0][0] : dy > 100 ? lp->vy_lim[0][1] : lp->vy_lim[0][2], 0)) return;
+ Control_M_Side(lp, dx, dx < 0 ? lp->vx_lim[0][0] : VXlim);
+}
+
+static void Control_M_Cruise(void){
+ Control_M_Far(LANDER_PARAMS.vx_lim[0][1]);
+}
+
+static void Control_M_Traverse(void){
+ Control_M_Far(LANDER_PARAMS.vx_lim[0][2]);
+}
+
+// Align: over 190 px up, hold over the platform
+static void Control_M_Align(void){
+ const Lander_Params *lp = &LANDER_PARAMS;
+ double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY();
+
+ if (Control_M_Vertical(lp, dx, dy, dy > 200 ? lp->vy_lim[0][0] : lp->vy_lim[0][1], 0)) return;
+ if (fabs(dx) < lp->hold_dx[0] || fabs(dx) < 20) return;
+ Control_M_Side(lp, dx, dx < -20 ? lp->vx_lim[0][0] : lp->vx_lim[0][3]);
+}
+
+// Descent: within 110 px, at most 210 px up. In the hold straight
+// down, outside it as for the right thruster.
+static void Control_M_Descent(void){
+ const Lander_Params *lp = &LANDER_PARAMS;
+ double dx = Robust_PX() - PLAT_X, dy = PLAT_Y - Robust_PY();
+ int hold = fabs(dx) < lp->hold_dx[0] || fabs(dx) < 20;
+
+ if (Control_M_Vertical(lp, dx, dy, dy > 100 ? lp->vy_lim[0][1] : lp->vy_lim[0][2], hold)) return;
+ if (hold) return;
+ if ((dx > 0 ? Robust_VX() : -Robust_VX()) >= 0){
+  Robust_MT(1);
+  if (dx > 0 && (Robust_Ang() < 269 || Robust_Ang() > 271)){
+   if(Robust_Ang() >= 90) Robust_Rot(270-Robust_Ang());
+   else Robust_Rot(-90-Robust_Ang());
+  }
+  else if (dx <= 0 && (Robust_Ang() < 89 || Robust_Ang() > 91)){
+   if(Robust_Ang() >= 270) Robust_Rot(450-Robust_Ang());
+   else Robust_Rot(90-Robust_Ang());
+  }
+  return;
+ }
+ if(Robust_Ang() > 1 && Robust_Ang() < 359){
+  if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
+  else Robust_Rot(-Robust_Ang());
+ }
+}
+
+static void (*const CONTROL_M_PHASES[PHASE_N])(void) = {
+ Control_M_Cruise, Control_M_Traverse, Control_M_Align, Control_M_Descent
+};
+
+void Lander_Control_M(void){
+ CONTROL_M_PHASES[Phase_Band()]();
+}
+
+static void Safety_Tick(void){
+  // The planner's commands are known, they get checked by rolling them
+  // out instead
+  if (POLICY_MODE == POLICY_PLAN){
+    Safety_Override_P();
+    return;
+  }
   //if(MT_OK && RT_OK && LT_OK) Safety_Override_N();
 	if(MT_OK) Safety_Override_M();
 	else if(RT_OK) Safety_Override_R();
 	else if(LT_OK) Safety_Override_L();
 }
 
+// Farthest (px) the lander can get in t seconds starting at speed v
+// (m/s)
+static double Safety_Reach(double v, double t){
+  return (v * t + .5 * SAFETY_ACCEL * t * t) * S_SCALE;
+}
+
+// What the override looks at besides the returns, packed for comparing
+static int Safety_Health(void){
+  return VELOCITY_X_OK | VELOCITY_Y_OK << 1 | POSITION_X_OK << 2 | POSITION_Y_OK << 3 |
+         ANGLE_OK << 4 | RANGEDIST_OK << 5 | MT_OK << 6 | RT_OK << 7 | LT_OK << 8 |
+         POLICY_MODE << 9;
+}
+
+// Whether Safety_Override_M/R/L() are sure to leave the commands alone
+// for the next k ticks, the nearest return being near px away, the
+// speed v and the lander read at (x, y). They react to a return closer
+// than the square of the speed (or dist_limit).
+static int Safety_Clear(int k, double near, double v, double x, double y){
+  double t = k * T_STEP, d = Safety_Reach(v, t), w = v + SAFETY_ACCEL * t, sx, sy;
+
+  // (x, y) is a reading as they take it, off by up to half of NP1 of
+  // the coordinate, and so are theirs wherever the lander gets to
+  sx = d + NP1 * (fabs(x) + d);
+  sy = d + NP1 * (fabs(y) + d);
+  // Nor may it be able to get into the descent phase's middle, the
+  // phase being left only PHASE_HYST px past its top
+  if (fabs(PLAT_X - x) < SAFETY_PLAT_X + sx && PLAT_Y - y < PHASE_LOW + PHASE_HYST + sy)
+    return 0;
+  return near - d > fmax(LANDER_PARAMS.dist_limit, w * w);
+}
+
+// Ticks the override can sit out from now, 0 if it has to look.
+// Doubles the horizon for as long as the bound holds.
+static int Safety_Quiet(void){
+  double near = 1000000, v, x = Robust_PX(), y = Robust_PY();
+  int k;
+
+  for (int i = 0; i < 36; i++)
+    if (SONAR_CLEAN[i] > -1 && SONAR_CLEAN[i] < near) near = SONAR_CLEAN[i];
+  // They go by velocity readings, each off by up to half of NP1, and
+  // so was the one the estimate last took
+  v = sqrt(mv_vx * mv_vx + mv_vy * mv_vy) * (1 + 2 * NP1);
+  for (k = 1; k <= SAFETY_QUIET && Safety_Clear(k, near, v, x, y); k <<= 1);
+  return k >> 1;
+}
+
+// The full checks run on the ticks Safety_Quiet() can't vouch for. New
+// returns or a health flag changing drop whatever is left of the bound.
+// Close to terrain the bound seldom holds and isn't worth working out
+// every tick, after it fails the full checks run SAFETY_RETRY ticks.
+static void Safety_Lazy(void){
+  int health = Safety_Health();
+  long cmds = cmd_count;
+
+  SAFETY_STATS.ticks++;
+  if (SAFETY_LAZY && POLICY_MODE != POLICY_PLAN){
+    if (health != sf_health || memcmp(SONAR_CLEAN, sf_seen, sizeof(sf_seen))){
+      sf_health = health;
+      memcpy(sf_seen, SONAR_CLEAN, sizeof(sf_seen));
+      if (sf_quiet) SAFETY_STATS.rearms++;
+      sf_quiet = 0;
+    }
+    if (!sf_quiet){
+      if (sf_wait) sf_wait--;
+      else if (!(sf_quiet = Safety_Quiet())) sf_wait = SAFETY_RETRY;
+    }
+    if (sf_quiet){
+      sf_quiet--;
+      SAFETY_STATS.skipped++;
+      return;
+    }
+  }
+  Safety_Tick();
+  if (cmd_count != cmds) SAFETY_STATS.acted++;
+}
+
+// Closes the tick Lander_Control() opened, timed as the "safety" stage
+void Safety_Override(void){
+  double t = Stage_Clock();
+
+  Safety_Lazy();
+  Stage_Account(&LANDER_STAGES[STAGE_N - 1], Stage_Clock() - t);
+  LANDER_TICK.runs++;
+  LANDER_TICK.last = tick_cost;
+  LANDER_TICK.total += tick_cost;
+  if (tick_cost > LANDER_TICK.worst) LANDER_TICK.worst = tick_cost;
+  if (tick_cost > STAGE_DEADLINE) LANDER_TICK.misses++;
+  tick_cost = 0;
+}
+
 void Safety_Override_M(void){
  double DistLimit;
  double Vmag;
@@ -796,29 +2127,25 @@ void Safety_Override_M(void){
  Vmag=Robust_VX()*Robust_VX();
  Vmag+=Robust_VY()*Robust_VY();
 
- DistLimit=fmax(75,Vmag);
- //if(fabs(PLAT_X-Robust_PX()) < 150)return;
- //&&(fabs(PLAT_Y-Robust_PY())<200)
- if (fabs(PLAT_X-Robust_PX())<100 && PLAT_Y-Robust_PY()<200){
-	 //printf("Here : \n");
-	 return;
- }
+ DistLimit=fmax(LANDER_PARAMS.dist_limit,Vmag);
+ // The descent is left to Lander_Control_M()
+ if (LANDER_PHASE == PHASE_DESCENT) return;
  
  dmin=1000000;
 ///fabs(PLAT_X-Robust_PX())<50 && fabs(PLAT_Y-Robust_PY())<200
  if(Robust_VX() > 0)
  {
   for (int i=5;i<14;i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin){
-	   dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin){
+	   dmin=SONAR_CLEAN[i];
   	   ang = 10*i;
    }
  }
  else if(Robust_VX() > 0 && (PLAT_X - Robust_PX()) > 15)
  {
   for (int i=22;i<32;i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin) {
-	dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin) {
+	dmin=SONAR_CLEAN[i];
    	ang = 10*i;
   }
  }
@@ -828,16 +2155,16 @@ void Safety_Override_M(void){
  if(dmin < fmin(DistLimit,fabs
   (PLAT_X - Robust_PX()))){
 		//Main_Thruster(1);
-    if(ang < 140 && Robust_VX() >0) Main_Thruster(1);
-    else if(ang > 220 && Robust_VX() < 0) Main_Thruster(1);
-    else{ Main_Thruster(0); return;}
+    if(ang < 140 && Robust_VX() >0) Robust_MT(1);
+    else if(ang > 220 && Robust_VX() < 0) Robust_MT(1);
+    else{ Robust_MT(0); return;}
     if(Robust_Ang() > ang){
 		        //printf("Deon\n");
-			  Rotate(180 + ang - Robust_Ang());
+			  Robust_Rot(180 + ang - Robust_Ang());
 		}
 		else{
 			//printf("Eond\n");       
-			Rotate(-180+ang-Robust_Ang()); 
+			Robust_Rot(-180+ang-Robust_Ang()); 
     }
 	}
  }
@@ -845,40 +2172,40 @@ dmin=1000000;
  if (Robust_VY()>5)      // Mind this! there is a reason for it...
  {
   for (int i=0; i<5; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin) {
-	   dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin) {
+	   dmin=SONAR_CLEAN[i];
 	   ang = 10*i;
    }
   for (int i=32; i<36; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin){
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin){
 	  ang = 10 *i;
-	  dmin=SONAR_DIST[i];
+	  dmin=SONAR_CLEAN[i];
    }
  }
  else
  {
   for (int i=14; i<22; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin){
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin){
 	   ang = 10*i;
-	   dmin=SONAR_DIST[i];
+	   dmin=SONAR_CLEAN[i];
    }
  }
  if (dmin<DistLimit)   // Too close to a surface in the horizontal direction
  {
-  if(fabs(PLAT_X - Robust_PX()) > 30){Main_Thruster(1);}
+  if(fabs(PLAT_X - Robust_PX()) > 30){Robust_MT(1);}
   
   if(Robust_Ang() < 359 && Robust_Ang() > 1){
-	  if(Robust_Ang() >= 180) Rotate(360-Robust_Ang());
-	  else Rotate(-Robust_Ang());
+	  if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
+	  else Robust_Rot(-Robust_Ang());
     //printf("Putar 4\n");
     return;
   }
   if (Robust_VY()>1.0){
-   Main_Thruster(0.0);
+   Robust_MT(0.0);
   }
   else
   {
-   Main_Thruster(1.0); 
+   Robust_MT(1.0); 
   }
   return;
  }
@@ -894,17 +2221,17 @@ double DistLimit;
  Vmag=Robust_VX()*Robust_VX();
  Vmag+=Robust_VY()*Robust_VY();
 
- DistLimit=fmax(75,Vmag);
+ DistLimit=fmax(LANDER_PARAMS.dist_limit,Vmag);
  
- //Rotate when landing
- if (fabs(PLAT_X-Robust_PX())<50&&fabs(PLAT_Y-Robust_PY())<200){
+ // Rotate when landing, in the descent phase's middle
+ if (LANDER_PHASE == PHASE_DESCENT && fabs(PLAT_X-Robust_PX())<SAFETY_PLAT_X){
          if(fabs(PLAT_X-Robust_PX()) < 50 && fabs(PLAT_Y-Robust_PY())<30){
 		    //Right_Thruster(0);
           //printf("Ready_R\n");
 		    if(Robust_Ang() > 0.5 && Robust_Ang() < 359.5){
-			      Left_Thruster(0);
-          if(Robust_Ang() >= 180) Rotate(360-Robust_Ang());
-          else Rotate(-Robust_Ang());
+			      Robust_LT(0);
+          if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
+          else Robust_Rot(-Robust_Ang());
 		    }
 	 }
 	 return;
@@ -914,16 +2241,16 @@ double DistLimit;
  if (Robust_VX()>0)
  {
   for (int i=5;i<14;i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin && Robust_VX() > 0){
-           dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin && Robust_VX() > 0){
+           dmin=SONAR_CLEAN[i];
            ang = 10*i;
  }
  }
  else
  {
   for (int i=22;i<32;i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin && Robust_VX() < 0) {
-        dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin && Robust_VX() < 0) {
+        dmin=SONAR_CLEAN[i];
         ang = 10*i;
    }
  }
@@ -933,9 +2260,9 @@ double DistLimit;
   if(dmin < fmin(DistLimit,fabs
   (PLAT_X - Robust_PX()))){
 		//Main_Thruster(1);
-    if(ang < 140 && Robust_VX() >0) Left_Thruster(1);
-    else if(ang > 220 && Robust_VX() < 0) Left_Thruster(1);
-    else{ Left_Thruster(0); return;}
+    if(ang < 140 && Robust_VX() >0) Robust_LT(1);
+    else if(ang > 220 && Robust_VX() < 0) Robust_LT(1);
+    else{ Robust_LT(0); return;}
     if(Robust_Ang() > ang){
       Robust_Rot(-90+ang-Robust_Ang());
     }
@@ -947,39 +2274,39 @@ double DistLimit;
   if (Robust_VY()>5)      // Mind this! there is a reason for it...
   {
   for (int i=0; i<5; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin) {
-           dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin) {
+           dmin=SONAR_CLEAN[i];
            ang = 10*i;
    }
   for (int i=32; i<36; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin){
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin){
           ang = 10 *i;
-          dmin=SONAR_DIST[i];
+          dmin=SONAR_CLEAN[i];
    }
   }
   else
  {
   for (int i=14; i<22; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin){
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin){
            ang = 10*i;
-           dmin=SONAR_DIST[i];
+           dmin=SONAR_CLEAN[i];
    }
  }
  if (dmin<DistLimit)   // Too close to a surface in the horizontal direction
  {
-  if(fabs(PLAT_X - Robust_PX()) > 150)Left_Thruster(1);
+  if(LANDER_PHASE <= PHASE_TRAVERSE && fabs(PLAT_X - Robust_PX()) > SAFETY_PUSH_X)Robust_LT(1);
 
   //Rotate to push against 
          if(Robust_Ang() < 269 || Robust_Ang() > 271){
-          if(Robust_Ang() > 90) Rotate(270-Robust_Ang());
-          else Rotate(-90-Robust_Ang());
+          if(Robust_Ang() > 90) Robust_Rot(270-Robust_Ang());
+          else Robust_Rot(-90-Robust_Ang());
           return;
          }
   if (Robust_VY()>1.0){
-   Left_Thruster(0.0);
+   Robust_LT(0.0);
   }
   else  {
-   Left_Thruster(1.0);
+   Robust_LT(1.0);
    //printf("431\n");
   }
   return;
@@ -998,15 +2325,15 @@ double DistLimit;
  Vmag=Robust_VX()*Robust_VX();
  Vmag+=Robust_VY()*Robust_VY();
 
- DistLimit=fmax(75,Vmag);
+ DistLimit=fmax(LANDER_PARAMS.dist_limit,Vmag);
  
- //Rotate when landing
- if (fabs(PLAT_X-Robust_PX())<50&&fabs(PLAT_Y-Robust_PY())<200){
+ // Rotate when landing, in the descent phase's middle
+ if (LANDER_PHASE == PHASE_DESCENT && fabs(PLAT_X-Robust_PX())<SAFETY_PLAT_X){
          if(fabs(PLAT_X-Robust_PX()) < 40 && fabs(PLAT_Y-Robust_PY())<30){
 		    //Right_Thruster(0);
           //printf("Ready_R\n");
 		    if(Robust_Ang() > 0.5 && Robust_Ang() < 359.5){
-			      Right_Thruster(0);
+			      Robust_RT(0);
           if(Robust_Ang() >= 180) Robust_Rot(360-Robust_Ang());
           else Robust_Rot(-Robust_Ang());
 		    }
@@ -1020,16 +2347,16 @@ double DistLimit;
  if (Robust_VX()>0)
  {
   for (int i=5;i<14;i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin && Robust_VX() > 0){
-           dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin && Robust_VX() > 0){
+           dmin=SONAR_CLEAN[i];
            ang = 10*i;
  }
  }
  else
  {
   for (int i=22;i<32;i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin && Robust_VX() < 0) {
-        dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin && Robust_VX() < 0) {
+        dmin=SONAR_CLEAN[i];
         ang = 10*i;
    }
  }
@@ -1042,9 +2369,9 @@ double DistLimit;
   if(dmin < fmin(DistLimit,fabs
   (PLAT_X - Robust_PX()))){
 		//Main_Thruster(1);
-    if(ang < 140 && Robust_VX() >0) Right_Thruster(1);
-    else if(ang > 220 && Robust_VX() < 0) Right_Thruster(1);
-    else{ Right_Thruster(0); return;}
+    if(ang < 140 && Robust_VX() >0) Robust_RT(1);
+    else if(ang > 220 && Robust_VX() < 0) Robust_RT(1);
+    else{ Robust_RT(0); return;}
     if(Robust_Ang() > ang){
 		        //printf("Deon\n");
 			  Robust_Rot(90 + ang - Robust_Ang());
@@ -1061,27 +2388,27 @@ dmin=1000000;
  if (Robust_VY()>5)      // Mind this! there is a reason for it...
  {
   for (int i=0; i<5; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin) {
-           dmin=SONAR_DIST[i];
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin) {
+           dmin=SONAR_CLEAN[i];
            ang = 10*i;
    }
   for (int i=32; i<36; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin){
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin){
           ang = 10 *i;
-          dmin=SONAR_DIST[i];
+          dmin=SONAR_CLEAN[i];
    }
  }
  else
  {
   for (int i=14; i<22; i++)
-   if (SONAR_DIST[i]>-1&&SONAR_DIST[i]<dmin){
+   if (SONAR_CLEAN[i]>-1&&SONAR_CLEAN[i]<dmin){
            ang = 10*i;
-           dmin=SONAR_DIST[i];
+           dmin=SONAR_CLEAN[i];
    }
  }
  if (dmin<DistLimit)   // Too close to a surface in the horizontal direction
  {
-  if(fabs(PLAT_X - Robust_PX()) > 150)Right_Thruster(1);
+  if(LANDER_PHASE <= PHASE_TRAVERSE && fabs(PLAT_X - Robust_PX()) > SAFETY_PUSH_X)Robust_RT(1);
   //Rotate to push against 
          if(Robust_Ang() < 89 || Robust_Ang() > 91){
           if(Robust_Ang() < 270) Robust_Rot(90-Robust_Ang());
@@ -1089,11 +2416,11 @@ dmin=1000000;
           return;
          }
   if (Robust_VY()>1.0){
-   Right_Thruster(0.0);
+   Robust_RT(0.0);
   }
   else
   {
-   Right_Thruster(0.8);
+   Robust_RT(0.8);
    //printf("431\n");
   }
   return;
@@ -1104,4 +2431,207 @@ dmin=1000000;
 
 }
 
+// Flies the batch of candidate commands (attitude to hold, thruster
+// powers) forward ROLL_STEPS model steps from the current state, after
+// first holding the planner's command for react steps. hit[k] is the
+// step candidate k first comes within reach of an obstacle, ROLL_STEPS
+// if it never does, and left[k] (unless NULL) how far from the platform
+// (px) it ends up. The candidates sit in parallel arrays and are
+// stepped together so the inner loops over the batch vectorize.
+static void Roll_Out(const double *s, const double *ox, const double *oy, int no,
+                     const double *att, double p[][3], int react, int *hit, double *left){
+  double x[ROLL_N], y[ROLL_N], vx[ROLL_N], vy[ROLL_N], hs[ROLL_N], hc[ROLL_N];
+  double ts[ROLL_N], tc[ROLL_N], ax[ROLL_N], ay[ROLL_N];
+  double d, q, u, w, f[3], x0, x1, y0, y1, dt = ROLL_DT * T_STEP;
+  double r = 16 + ROLL_CLEAR, r2 = r * r;
+  double step = ROLL_DT * MAX_ROT_RATE, ss = sin(step), cs = cos(step);
+  double ps = sin(plan_dir * PI / 180), pc = cos(plan_dir * PI / 180);
+  int ok[3] = {MT_OK, RT_OK, LT_OK};
+  double accel[3] = {MT_ACCEL * (1 - NP1), RT_ACCEL * (1 - NP1), LT_ACCEL * (1 - NP1)};
+
+  // Headings are carried as (sin, cos) pairs so the steps below need no
+  // trig: turning is a rotation by the fixed per-step angle, and the
+  // cosine of what is left to turn is a dot product with the target
+  for (int k = 0; k < ROLL_N; k++){
+    x[k] = s[0]; y[k] = s[1]; vx[k] = s[2]; vy[k] = s[3];
+    hs[k] = sin(s[4] * PI / 180);
+    hc[k] = cos(s[4] * PI / 180);
+    ts[k] = sin(att[k] * PI / 180);
+    tc[k] = cos(att[k] * PI / 180);
+    hit[k] = ROLL_STEPS;
+  }
+  for (int j = 0; j < ROLL_STEPS; j++){
+    // Turn towards the held attitude, then thrust, held back by how far
+    // off the held attitude we still are as Safety_Override_P() does
+    // when flying one. Side thrusters push at right angles to the main
+    // one.
+    for (int k = 0; k < ROLL_N; k++){
+      u = j < react ? ps : ts[k];
+      w = j < react ? pc : tc[k];
+      if (hs[k] * u + hc[k] * w >= cs){
+        hs[k] = u;
+        hc[k] = w;
+      }
+      else {
+        d = u * hc[k] - w * hs[k] >= 0 ? ss : -ss;
+        q = hs[k] * cs + hc[k] * d;
+        hc[k] = hc[k] * cs - hs[k] * d;
+        hs[k] = q;
+      }
+      d = fmax(0, hs[k] * u + hc[k] * w);
+      for (int i = 0; i < 3; i++) f[i] = ok[i] * accel[i] * (j < react ? plan_power[i] : p[k][i] * d);
+      ax[k] = f[0] * hs[k] + (f[2] - f[1]) * hc[k];
+      ay[k] = f[0] * hc[k] - (f[2] - f[1]) * hs[k] - G_ACCEL;
+    }
+    for (int k = 0; k < ROLL_N; k++){
+      vx[k] += ax[k] * dt;
+      vy[k] += ay[k] * dt;
+      x[k] += vx[k] * dt * S_SCALE;
+      y[k] -= vy[k] * dt * S_SCALE;
+    }
+    // Obstacles outside the box around the whole batch can't be hit by
+    // any of it, which early on, with the batch still bunched up, is
+    // most of them
+    x0 = x1 = x[0];
+    y0 = y1 = y[0];
+    for (int k = 0; k < ROLL_N; k++){
+      x0 = x[k] < x0 ? x[k] : x0;
+      x1 = x[k] > x1 ? x[k] : x1;
+      y0 = y[k] < y0 ? y[k] : y0;
+      y1 = y[k] > y1 ? y[k] : y1;
+      ax[k] = r2;
+    }
+    for (int o = 0; o < no; o++){
+      if (ox[o] < x0 - r || ox[o] > x1 + r || oy[o] < y0 - r || oy[o] > y1 + r) continue;
+      for (int k = 0; k < ROLL_N; k++){
+        d = (x[k] - ox[o]) * (x[k] - ox[o]) + (y[k] - oy[o]) * (y[k] - oy[o]);
+        ax[k] = d < ax[k] ? d : ax[k];
+      }
+    }
+    for (int k = 0; k < ROLL_N; k++)
+      if (ax[k] < r2 && j < hit[k]) hit[k] = j;
+  }
+  if (left)
+    for (int k = 0; k < ROLL_N; k++)
+      left[k] = sqrt((x[k] - PLAT_X) * (x[k] - PLAT_X) + (y[k] - PLAT_Y) * (y[k] - PLAT_Y));
+}
+
+// Whether the planner's command is sure to stay clear of the obstacles
+// over the whole look-ahead, which Roll_Out() would otherwise have to
+// show. Wherever the command's thrust ends up pointing, after j steps
+// the lander is within a ball around where coasting under gravity
+// takes it, growing with the thrust as the steps add it up. One ball
+// covers SAFETY_SPAN steps, centred on the last of them and taking in
+// how far coasting moves in the ones before.
+static int Roll_Clear(const double *s, const double *ox, const double *oy, int no){
+  double d, q, p, cx, cy, c, dt = ROLL_DT * T_STEP, r = 16 + ROLL_CLEAR;
+  double f = MT_OK * MT_ACCEL * plan_power[0] + RT_OK * RT_ACCEL * plan_power[1] +
+             LT_OK * LT_ACCEL * plan_power[2];
+  double v = sqrt(s[2] * s[2] + s[3] * s[3]);
+
+  // Latest steps first, an obstacle in reach is usually only reached
+  // late in the look-ahead
+  for (int j = ROLL_STEPS; j > 0; j -= SAFETY_SPAN){
+    q = j * (j + 1) / 2 * dt * dt;
+    p = j > SAFETY_SPAN ? (j - SAFETY_SPAN) * (j - SAFETY_SPAN + 1) / 2 * dt * dt : 0;
+    cx = s[0] + j * dt * s[2] * S_SCALE;
+    cy = s[1] - (j * dt * s[3] - G_ACCEL * q) * S_SCALE;
+    c = r + (f * q + SAFETY_SPAN * dt * v + G_ACCEL * (q - p)) * S_SCALE;
+    for (int o = 0; o < no; o++){
+      d = (ox[o] - cx) * (ox[o] - cx) + (oy[o] - cy) * (oy[o] - cy);
+      if (d < c * c) return 0;
+    }
+  }
+  return 1;
+}
+
+// Predictive override for the planner, a last resort filter on its
+// commands. Candidate 0 is what the planner just commanded, 1 the
+// escape being flown if there is one (else coasting), the rest thrust
+// flat out in directions spread over the upper half plane. The
+// obstacles are the occupancy ring, current sonar returns and
+// remembered terrain, except what lies on the platform itself.
+//
+// The planner is left alone as long as, after following it for another
+// ROLL_REACT steps, some candidate would still get clear. Only when that
+// is no longer true does the override take over, flying the fastest
+// clear candidate: the one whose look-ahead ends nearest the platform.
+void Safety_Override_P(void){
+  double att[ROLL_N], p[ROLL_N][3], left[ROLL_N], ox[36], oy[36], a, d;
+  const double *s = plan_state;
+  int hit[ROLL_N], no = 0, best;
+
+  if (!MT_OK && !RT_OK && !LT_OK) return;
+  // Lined up over the platform the planner's descent is what lands us.
+  // Mid flip the sonar returns are smeared over the turn and the model
+  // can't be trusted to second-guess it either.
+  if (fabs(s[0] - PLAT_X) <= 20) return;
+  if (!roll_active && fabs(fmod(plan_dir - s[4] + 540, 360) - 180) > 90) return;
+
+  for (int i = 0; i < 36; i++){
+    if (occ_ring[i] <= -1) continue;
+    a = (s[4] + 10 * i) * PI / 180;
+    ox[no] = s[0] + occ_ring[i] * sin(a);
+    oy[no] = s[1] - occ_ring[i] * cos(a);
+    if (fabs(ox[no] - PLAT_X) < 40 && fabs(oy[no] - PLAT_Y) < 12) continue;
+    no++;
+  }
+  if (!no) return;
+  // The rollout is skipped when the lazy bound shows it would come out
+  // clear, see Safety_Override()
+  if (SAFETY_LAZY && !roll_active && Roll_Clear(s, ox, oy, no)){
+    SAFETY_STATS.skipped++;
+    return;
+  }
+
+  for (int k = 0; k < ROLL_N; k++){
+    if (k == 0){
+      att[k] = plan_dir;
+      for (int i = 0; i < 3; i++) p[k][i] = plan_power[i];
+    }
+    else if (k == 1){
+      att[k] = roll_active ? roll_att : s[4];
+      for (int i = 0; i < 3; i++) p[k][i] = roll_active ? roll_power[i] : 0;
+    }
+    else {
+      a = -120 + 240.0 * (k - 2) / (ROLL_N - 3);
+      att[k] = a + (MT_OK ? 0 : RT_OK ? 90 : -90);
+      Thrust_Allocate(100 * sin(a * PI / 180), 100 * cos(a * PI / 180), att[k], p[k]);
+    }
+  }
+
+  // An escape under way is only handed back once the planner's own
+  // command is clear, otherwise the two take turns and neither turn
+  // is ever finished
+  Roll_Out(s, ox, oy, no, att, p, ROLL_REACT, hit, NULL);
+  for (int k = 0; k < (roll_active ? 1 : ROLL_N); k++)
+    if (hit[k] == ROLL_STEPS){
+      roll_active = 0;
+      return;
+    }
+
+  // Out of time, pick an escape from here: the fastest one, the clear
+  // candidate that ends the look-ahead closest to the platform
+  Roll_Out(s, ox, oy, no, att, p, 0, hit, left);
+  // An escape already under way is kept while it stays clear, or while
+  // nothing is and it still does no worse than the planner. Starting
+  // from scratch with no way out the planner is left to it, flipping
+  // between equally hopeless escapes only stalls the turn
+  best = 0;
+  for (int k = 1; k < ROLL_N; k++)
+    if (hit[k] == ROLL_STEPS && (!best || left[k] < left[best])) best = k;
+  if (roll_active && (hit[1] == ROLL_STEPS || (!best && hit[1] >= hit[0]))) best = 1;
+  roll_active = best != 0;
+  if (!best) return;
+  roll_att = att[best];
+  for (int i = 0; i < 3; i++) roll_power[i] = p[best][i];
+
+  d = fmod(att[best] - s[4] + 540, 360) - 180;
+  if (fabs(d) > PLAN_DEADBAND) Robust_Rot(d);
+  d = fmax(0, cos(d * PI / 180));
+  Robust_MT(p[best][0] * d);
+  Robust_RT(p[best][1] * d);
+  Robust_LT(p[best][2] * d);
+}
+
 void vv(void){return;}
\ No newline at end of file
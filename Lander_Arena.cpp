@@ -0,0 +1,73 @@
+/*
+	Memory arena - see Lander_Arena.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Lander_Arena.h"
+
+Arena_Stats ARENA_STATS;
+
+static unsigned char *block = NULL;
+static size_t bottom, top;      // free space is [bottom, top)
+
+static size_t Round_Up(size_t n){
+ return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static int Setup(void){
+ if (block) return 1;
+ if (posix_memalign((void **)&block, ARENA_ALIGN, ARENA_SIZE)){
+  block = NULL;
+  fprintf(stderr, "Unable to set up a %zu MB arena\n", ARENA_SIZE >> 20);
+  return 0;
+ }
+ ARENA_STATS.heap++;
+ bottom = 0;
+ top = ARENA_SIZE;
+ return 1;
+}
+
+static void Note_Use(void){
+ if (bottom + ARENA_SIZE - top > ARENA_STATS.peak) ARENA_STATS.peak = bottom + ARENA_SIZE - top;
+}
+
+void *Arena_Alloc(size_t n){
+ n = Round_Up(n);
+ if (!Setup() || n > top - bottom){
+  ARENA_STATS.failed++;
+  return NULL;
+ }
+ top -= n;
+ ARENA_STATS.allocs++;
+ Note_Use();
+ return block + top;
+}
+
+size_t Arena_Mark(void){
+ return Setup() ? top : ARENA_SIZE;
+}
+
+void Arena_Release(size_t mark){
+ if (block && mark > top && mark <= ARENA_SIZE) top = mark;
+}
+
+void *Arena_Scratch(size_t n){
+ void *p;
+
+ n = Round_Up(n);
+ if (!Setup() || n > top - bottom){
+  ARENA_STATS.failed++;
+  return NULL;
+ }
+ p = block + bottom;
+ bottom += n;
+ ARENA_STATS.allocs++;
+ Note_Use();
+ return p;
+}
+
+void Arena_Episode(void){
+ bottom = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _LANDER_ARENA_H
+#define _LANDER_ARENA_H
+
+/*
+  Memory arena for the headless simulator.
+
+  The terrain cache and its tile index, the procedural ground, the
+  framebuffers and whatever scratch an episode needs all come out of
+  one block of ARENA_SIZE bytes, taken from the heap once per process
+  (once per campaign worker), each allocation ARENA_ALIGN aligned so
+  no two share a cache line. Nothing is freed piecemeal.
+
+  Buffers that live as long as a map or the renderer are taken from
+  the top of the block like a stack, their owner notes Arena_Mark()
+  before the first and gives everything back with Arena_Release().
+  Episode scratch is taken from the bottom and Arena_Episode(), called
+  by Sim_Reset(), drops all of it by resetting a pointer. A worker
+  that reloads a map or flies another episode reuses the same bytes,
+  after setup the heap is never asked again; ARENA_STATS keeps count.
+*/
+
+#include <stddef.h>
+
+#define ARENA_SIZE ((size_t)32 << 20)
+#define ARENA_ALIGN 64
+
+struct Arena_Stats {
+ long allocs;        // served from the block, either end
+ long heap;          // trips to the heap, the block itself included
+ long failed;        // requests that didn't fit
+ size_t peak;        // most of the block in use at once, bytes
+};
+
+extern Arena_Stats ARENA_STATS;
+
+void *Arena_Alloc(size_t n);      // top end, until Arena_Release()
+size_t Arena_Mark(void);
+void Arena_Release(size_t mark);
+void *Arena_Scratch(size_t n);    // bottom end, until the next Arena_Episode()
+void Arena_Episode(void);
+
+#endif
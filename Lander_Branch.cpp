@@ -0,0 +1,153 @@
+/*
+	What-if branching from a point in a flight.
+
+	Flies one episode up to a given time (by default the tick its
+	failures are injected), snapshots the simulator and flight computer
+	there and flies many continuations from the snapshot with fresh
+	noise. Branch 0 keeps the original random stream and must end the way
+	the straight run did, which is checked. Takes the same map/mode/
+	component arguments as Lander_Headless plus:
+
+	  -s seed       seed of the episode (default 1)
+	  -t time       branch at this simulated time instead
+	  -n branches   continuations to fly (default 1000)
+	  -j workers    worker processes (default one per CPU)
+	  -v            print one line per branch
+
+	e.g.
+
+	     Lander_Branch hard.ppm 3 1 8 -s 12 -n 5000
+
+	Workers are forked once; after that starting a branch is a memcpy of
+	the snapshot, not a new episode from t = 0.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+
+struct Br_Result {
+ int outcome;
+ double t, vy;
+};
+
+static double Wall_Time(void){
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]){
+ int mode, comp[SIM_N_COMP], ncomp;
+ int branches = 1000, workers = (int)sysconf(_SC_NPROCESSORS_ONLN), verbose = 0, nargs = 0;
+ long seed = 1;
+ double at = -1, wall, restore;
+ char *args[SIM_N_COMP + 1];
+ int count[4] = {0, 0, 0, 0}, status;
+ Sim_Result straight;
+ Sim_Snapshot snap;
+ Sim_Sketch t_land, v_land;
+
+ for (int i = 2; i < argc; i++){
+  if (!strcmp(argv[i], "-n") && i + 1 < argc) branches = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atol(argv[++i]);
+  else if (!strcmp(argv[i], "-t") && i + 1 < argc) at = atof(argv[++i]);
+  else if (!strcmp(argv[i], "-j") && i + 1 < argc) workers = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-v")) verbose = 1;
+  else if (nargs <= SIM_N_COMP) args[nargs++] = argv[i];
+ }
+ if (argc < 3 || !Sim_Parse_Mode(nargs, args, &mode, comp, &ncomp)){
+  fprintf(stderr, "Usage: Lander_Branch MapName FailMode [component1] ... [-s seed] [-t time]"
+          " [-n branches] [-j workers] [-v]\n");
+  exit(1);
+ }
+ if (!Sim_Load_Map(argv[1])) exit(1);
+ if (branches < 1) branches = 1;
+ if (workers < 1) workers = 1;
+
+ // The straight run, then the same episode again up to the branch point
+ Sim_Reset(mode, comp, ncomp, seed);
+ Sim_Run(&straight);
+ Sim_Reset(mode, comp, ncomp, seed);
+ if (at < 0) at = SIM_FAIL_TIME;
+ if (at < 0){
+  fprintf(stderr, "Mode 0 injects no failure, give the branch time with -t\n");
+  exit(1);
+ }
+ while (SIM_TIME < at)
+  if (Sim_Step() != SIM_FLYING){
+   fprintf(stderr, "The episode ended at %.2f s, before %.2f s\n", SIM_TIME, at);
+   exit(1);
+  }
+ Sim_Save(&snap);
+
+ restore = Wall_Time();
+ for (int i = 0; i < 1000; i++) Sim_Restore(&snap);
+ restore = (Wall_Time() - restore) / 1000;
+
+ printf("%s seed %ld: straight run %s at %.2f s, branching at %.2f s (tick %d)\n", argv[1],
+        seed, Sim_Outcome_Name(straight.outcome), straight.t, SIM_TIME, SIM_TICKS);
+ printf("snapshot %.1f KB, restore %.2f us\n", sizeof(snap) / 1024.0, restore * 1e6);
+
+ Br_Result *res = (Br_Result *)mmap(NULL, sizeof(Br_Result) * branches + sizeof(int),
+                                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+ int *next = (int *)(res + branches);
+ *next = 0;
+
+ wall = Wall_Time();
+ fflush(stdout);
+ for (int w = 0; w < workers; w++){
+  if (fork()) continue;
+  Sim_Result r;
+  int i;
+  while ((i = __sync_fetch_and_add(next, 1)) < branches){
+   Sim_Restore(&snap);
+   if (i) Sim_Seed(seed ^ ((long)i << 32));
+   Sim_Run(&r);
+   res[i].outcome = r.outcome;
+   res[i].t = r.t;
+   res[i].vy = r.vy;
+  }
+  _exit(0);
+ }
+ for (int w = 0; w < workers; w++)
+  if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)){
+   fprintf(stderr, "A worker failed\n");
+   exit(1);
+  }
+ wall = Wall_Time() - wall;
+
+ Sim_Sketch_Reset(&t_land);
+ Sim_Sketch_Reset(&v_land);
+ for (int i = 0; i < branches; i++){
+  count[res[i].outcome]++;
+  if (res[i].outcome == SIM_LANDED){
+   Sim_Sketch_Add(&t_land, res[i].t);
+   Sim_Sketch_Add(&v_land, fabs(res[i].vy));
+  }
+  if (verbose)
+   printf("branch %d: %s t=%.2f vy=%.2f\n", i, Sim_Outcome_Name(res[i].outcome), res[i].t,
+          res[i].vy);
+ }
+
+ printf("branch 0 %s at %.2f s, %s the straight run\n", Sim_Outcome_Name(res[0].outcome),
+        res[0].t, res[0].outcome == straight.outcome && res[0].t == straight.t ? "same as" : "DIFFERS FROM");
+ printf("%d branches: landed %d, crashed %d, timeout %d\n", branches, count[SIM_LANDED],
+        count[SIM_CRASHED], count[SIM_TIMEOUT]);
+ if (count[SIM_LANDED])
+  printf("landing time p50/p90/p99 %.2f/%.2f/%.2f s, touchdown speed p50/p90/p99 %.2f/%.2f/%.2f m/s\n",
+         Sim_Sketch_Quantile(&t_land, .5), Sim_Sketch_Quantile(&t_land, .9),
+         Sim_Sketch_Quantile(&t_land, .99), Sim_Sketch_Quantile(&v_land, .5),
+         Sim_Sketch_Quantile(&v_land, .9), Sim_Sketch_Quantile(&v_land, .99));
+ printf("wall time %.2f s (%.3f s per branch per worker)\n", wall, wall * workers / branches);
+ Sim_Free_Map();
+ return res[0].outcome != straight.outcome || res[0].t != straight.t;
+}
@@ -22,6 +22,165 @@
 #define EPSILON_ANGLE 5
 #define AMOUNT_OF_FAULTY 1
 
+// Position readings averaged per history sample. The headless tools
+// build the flight computer with fewer, see the Makefile.
+#ifndef POSITION_SAMPLES
+#define POSITION_SAMPLES 1000000
+#endif
+// Heading estimate once the angle sensor is found broken: readings of
+// the broken sensor folded in per tick, and the gain they get. Relies
+// on the broken sensor reading centred on the true angle, as it does in
+// both simulators, see Angle_Update()
+#define ANGLE_SAMPLES 16
+#define ANGLE_GAIN .002
+
+// Policy selection (LANDER_POLICY environment variable)
+#define POLICY_LIVE 0
+#define POLICY_TABLE 1
+#define POLICY_PLAN 2
+
+// Trajectory planner. Touchdown speed aimed for, fraction of the
+// thrust left over after gravity the braking curves may count on, the
+// altitude (m) below which the main thruster stays near upright and the
+// time (s) before touchdown a side thruster cuts out to turn upright.
+#define PLAN_V_TD 3.0
+#define PLAN_MARGIN .5
+#define PLAN_FLARE_H 3.0
+#define PLAN_FLARE_T .15
+#define PLAN_CLEARANCE 15.0
+#define PLAN_GAIN 3.0
+// Attitude error (degrees) left alone, about twice the angle sensor
+// noise. The thrust allocation makes up for the rest.
+#define PLAN_DEADBAND 3.0
+// Coordinate descent sweeps of the thrust allocation
+#define ALLOC_SWEEPS 4
+
+// Predictive safety override: candidate commands, model steps of
+// ROLL_DT ticks each, steps the planner is trusted for before an escape
+// must still exist, and pixels kept from sonar returns on top of the
+// lander's radius
+#define ROLL_N 16
+#define ROLL_STEPS 30
+#define ROLL_DT 10
+#define ROLL_REACT 4
+#define ROLL_CLEAR 4
+
+// Occupancy map of sonar returns in world coordinates. Cells of
+// OCC_CELL px grouped in tiles of 2^OCC_SHIFT cells a side, at most
+// OCC_TILES tiles held at once (a power of two), found by hashing the
+// tile position and probing OCC_PROBE slots. A cell counts as occupied
+// once OCC_SEEN returns have landed in it, clearance queries look out
+// to OCC_RANGE px. A ray's remembered clearance is looked up again
+// every OCC_STRIDE ticks, a third of the rays each tick.
+#define OCC_CELL 8
+#define OCC_SHIFT 4
+#define OCC_TILE (1 << OCC_SHIFT)
+#define OCC_TILES 64
+#define OCC_PROBE 4
+#define OCC_SEEN 2
+#define OCC_RANGE 256
+#define OCC_STRIDE 3
+
+// Scan matching against the occupancy map once both the position and
+// the velocity sensor of an axis are lost: offsets (px) tried either
+// way of the estimate, the spacing between them, the fraction of the
+// best one taken out of the position per tick and the velocity
+// correction (m/s per m of offset) it makes
+#define SCAN_WINDOW 12
+#define SCAN_STEP 2
+#define SCAN_GAIN .2
+#define SCAN_VGAIN .5
+
+// Gain of the position history on the velocity estimate
+#define MOTION_GAIN .05
+
+// Sonar health. Every new return on a ray goes into a ring of the last
+// SONAR_HIST returns on that ray. A return closer than SONAR_MIN px is
+// inside the lander's hull (radius 16) and can't be real. One more
+// than SONAR_TOL px from
+// the ring's median that neither neighbouring ray backs up (within
+// SONAR_TOL px plus SONAR_SPREAD of the range) is an outlier: the ray
+// is marked invalid in SONAR_VALID and SONAR_CLEAN carries the median
+// instead. Once outliers make up more than SONAR_FAULTY of the last
+// ~SONAR_WINDOW returns the sonar is taken as failed, RANGEDIST_OK
+// drops and every ray of SONAR_CLEAN reads -1.
+#define SONAR_HIST 5          // the median network in Sonar_Update() is for 5, asserted there
+#define SONAR_FAR 1024.0      // px, what no return counts as in the ring
+#define SONAR_MIN 12.0
+#define SONAR_TOL 32.0
+#define SONAR_SPREAD .2
+#define SONAR_WINDOW 16.0
+#define SONAR_FAULTY .35
+
+// Mission phases, by where the lander is against the platform: over
+// PHASE_FAR px to the side, between PHASE_NEAR and PHASE_FAR, within
+// PHASE_NEAR and over PHASE_LOW px above it, within PHASE_NEAR and
+// lower. Phase_Update() works it out once per tick from the position
+// estimate. Lander_Control_M/R/L() run a handler per phase with only
+// the checks that come up there: cruise and traverse fly toward the
+// platform at their speed limit, align adds the column and the hold.
+// Descent goes straight down in the hold, where over_ratio doesn't stop
+// it, and outside it, instead of the side correction, pushes toward the
+// platform while still or drifting away from it. A column_l/r or
+// hold_dx wider than PHASE_NEAR - PHASE_HYST px is cut to the phase.
+// Safety_Override_M/R/L() read it too: M leaves the descent to the
+// policy, L and R turn upright only in its middle (SAFETY_PLAT_X px)
+// and push off terrain only in cruise or traverse, and there beyond
+// SAFETY_PUSH_X px. A boundary is crossed back only PHASE_HYST px past
+// it, the phase doesn't flip on every bit of noise. The last PHASE_LOG
+// transitions of the flight are kept in PHASE_EVENTS.
+#define PHASE_CRUISE 0
+#define PHASE_TRAVERSE 1
+#define PHASE_ALIGN 2
+#define PHASE_DESCENT 3
+#define PHASE_N 4
+#define PHASE_FAR 200.0
+#define PHASE_NEAR 100.0
+#define PHASE_LOW 200.0
+#define PHASE_HYST 10.0
+#define PHASE_LOG 64
+
+// Lazy safety override. Safety_Override() only runs the full checks
+// while it can't rule out that they would step in. After each one it
+// works out for how many ticks (up to SAFETY_QUIET) the override is
+// sure to leave the commands alone: the nearest return must stay
+// farther than what it reacts to even if the lander accelerates at
+// SAFETY_ACCEL (main and one side thruster flat out, plus gravity, in
+// m/s^2) the whole time, and the lander must stay out of the middle
+// of the descent phase (SAFETY_PLAT_X px either side of the platform)
+// where Safety_Override_L/R() turn it upright. Any change to the returns or
+// to a health flag drops the bound and it is worked out afresh. The
+// planner's override rolls out a new command every tick; it skips the
+// rollout when a cheaper bound, in SAFETY_SPAN step balls, shows the
+// command clear. LANDER_SAFETY=full in the environment runs the full
+// checks every tick, for comparison.
+#define SAFETY_QUIET 64
+#define SAFETY_RETRY 8
+#define SAFETY_ACCEL (MT_ACCEL + RT_ACCEL + G_ACCEL)
+#define SAFETY_PLAT_X 50.0
+#define SAFETY_PUSH_X 150.0
+#define SAFETY_SPAN 5
+
+// Policy lookup table layout. Grid nodes over the offset from the
+// platform and the velocity, denser around the thresholds the policies
+// switch on. All angle bins of one node are packed into a single 32
+// byte half cache line. Built offline by Policy_Gen. A cell whose nodes
+// differ in thrust by more than PT_SPREAD (in 1/255) or in the rotation
+// target has a policy switch inside it that the grid doesn't resolve,
+// the live policy decides there. Policy_Gen settles that per cell and
+// angle bin and keeps the answer, one bit per bin, in the two bytes of
+// slot PT_MASK of the cell's lower corner node.
+#define PT_NDX 29
+#define PT_NDY 14
+#define PT_NVX 13
+#define PT_NVY 13
+#define PT_NANG 12
+#define PT_LINE 16
+#define PT_MASK PT_NANG
+#define PT_NTHR 3
+#define PT_CELLS (PT_NDX*PT_NDY*PT_NVX*PT_NVY)
+#define PT_SPREAD 32
+
 // Global variables accessible to your flight computer
 extern int MT_OK;
 extern int RT_OK;
@@ -29,6 +188,8 @@ extern int LT_OK;
 extern double PLAT_X;
 extern double PLAT_Y;
 extern double SONAR_DIST[36];
+extern double SONAR_CLEAN[36];  // SONAR_DIST with outliers filtered, see Sonar_Update()
+extern int SONAR_VALID[36];
 extern double DD;
 extern double ST_ANG;
 
@@ -54,6 +215,145 @@ extern int FLAGANGLE;
 extern int FLAGRANGEDIST;
 
 extern double PREVIOUS_X;
+extern int POLICY_MODE;
+// The live policies Stage_Policy() flies, main, right and left thruster:
+// Lander_Control_M/R/L, unless Lander_Shadow swaps in a candidate's
+extern void (*LANDER_POLICIES[PT_NTHR])(void);
+extern const double PT_DX_NODES[PT_NDX];
+extern const double PT_DY_NODES[PT_NDY];
+extern const double PT_VX_NODES[PT_NVX];
+extern const double PT_VY_NODES[PT_NVY];
+
+// One policy table entry: thruster power in 1/255 and absolute target
+// angle in 360/256 degree steps (0, 90, 180 and 270 are exact)
+struct PT_Entry {
+ unsigned char power;
+ unsigned char target;
+};
+// Thresholds of the live policies, settable at run time so they can
+// be tuned (Lander_Tune) and loaded back with LANDER_PARAMS=file. The
+// defaults are the hand-picked values. Every field is a double so the
+// tuner can treat the struct as a vector of LP_N values; indices
+// [PT_NTHR] are main, right, left as in the policy table.
+struct Lander_Params {
+ // Horizontal speed limits (m/s). Main and right: left of the platform,
+ // over 200 px off, over 100 px off, closer, right flying on the last
+ // one everywhere. Left: over 200, over 100, over 40 px off, closer.
+ double vx_lim[PT_NTHR][4];
+ // Descent speed limits (m/s, negative) over 200, over 100 px above the
+ // platform and closer
+ double vy_lim[PT_NTHR][3];
+ // Time to cover the horizontal distance over the time to touchdown
+ // above which descent stops
+ double over_ratio;
+ // Side thrusters cut out within this of the platform (px)
+ double cut_dx, cut_dy;
+ // Column over the platform (px either side) left alone while higher
+ // than 200 px, at most PHASE_NEAR - PHASE_HYST
+ double column_l, column_r;
+ // No horizontal correction within this of the platform (px), at most
+ // PHASE_NEAR - PHASE_HYST. Right holds only on the right of it above
+ // the descent phase.
+ double hold_dx[PT_NTHR];
+ // Horizontal correction right and left of the platform beyond (px),
+ // above the descent phase
+ double side_dx[PT_NTHR][2];
+ // Distance (px) below which the safety overrides react to terrain
+ double dist_limit;
+ // Spread of two readings marking a sensor broken, in the order
+ // position x, position y, velocity x, velocity y, angle, and how many
+ // of the 25 pairs must show it
+ double eps[5];
+ double faulty;
+};
+#define LP_N ((int)(sizeof(Lander_Params) / sizeof(double)))
+
+extern Lander_Params LANDER_PARAMS;
+extern const Lander_Params LANDER_PARAMS_DEFAULT;
+extern const char *LP_NAMES[];
+
+// Multi-rate schedule of Lander_Control(). Each stage runs on the ticks
+// where the tick count % period == offset % period, and the cost of
+// every run is kept for Lander_Stage_Report(). The table is in
+// Lander.cpp. Every stage is at the full rate: a failure caught a few
+// ticks late has already been averaged into the position history, and
+// scan matching and the clearance ring go stale between runs, each of
+// them lost landings when slowed to 2-4 ticks.
+#define STAGE_N 10
+#define STAGE_HEALTH 1      // fault checking and sensor substitution
+#define STAGE_SCAN 1        // scan matching, with a broken position sensor
+#define STAGE_MAP 1         // occupancy map update
+
+#define STAGE_DEADLINE T_STEP   // s, a tick costing more misses its deadline
+
+struct Lander_Stage {
+ const char *name;
+ int period, offset;
+ void (*run)(void);
+ long runs;
+ double last, total, worst;     // s
+};
+
+// The whole tick, Lander_Control() and Safety_Override() together
+struct Lander_Tick {
+ long runs, misses;
+ double last, total, worst;     // s
+};
+
+struct Phase_Event {
+ int tick;                // of Lander_Control() since the reset
+ int from, to;            // -1 before the first tick
+ double dx, dy;           // px off and above the platform
+};
+
+// What the lazy safety override did, since Lander_Stage_Clear()
+struct Safety_Stats {
+ long ticks, skipped;
+ long rearms;             // bounds dropped on new returns or health flags
+ long acted;              // full checks that changed a command
+};
+
+extern Lander_Stage LANDER_STAGES[STAGE_N];
+extern Lander_Tick LANDER_TICK;
+extern Safety_Stats SAFETY_STATS;
+extern int SAFETY_LAZY;
+extern int LANDER_PHASE;
+extern const char *PHASE_NAMES[PHASE_N];
+extern Phase_Event PHASE_EVENTS[PHASE_LOG];
+extern int PHASE_COUNT;  // transitions this flight, the last PHASE_LOG of them kept
+void Lander_Stage_Clear(void);
+void Lander_Stage_Report(void);
+
+// Complete flight computer state, for checkpointing a flight and
+// branching off it (Lander_Save/Lander_Restore). Plain data, copying
+// one is a memcpy; most of its ~18KB is the occupancy map. The
+// parameters in LANDER_PARAMS are configuration and are not part of it.
+struct Lander_State {
+ double pos_x[22], pos_y[22], vel_x[22], vel_y[22];
+ int ok[6];               // VELOCITY_X/Y_OK, POSITION_X/Y_OK, ANGLE_OK, RANGEDIST_OK
+ int flag[6];             // FLAGPOSX ... FLAGANGLE, FLAGRANGEDIST
+ int count;
+ double dd, st_ang;
+ double (*alt[6])(void);  // the *_alt sensor functions
+ double plan_state[5], plan_dir, plan_power[3];
+ double roll_att, roll_power[3];
+ int roll_active;
+ int occ_tx[OCC_TILES], occ_ty[OCC_TILES], occ_used[OCC_TILES];
+ unsigned char occ_cell[OCC_TILES][OCC_TILE * OCC_TILE];
+ int occ_tick;
+ double occ_last[36], occ_ring[36], occ_held[36];
+ double ae_ang, ae_pend;
+ double mv_vx, mv_vy, mv_power[3];
+ int sched_tick;
+ double sn_ring[SONAR_HIST][36], sn_last[36], sn_rate, sonar_clean[36];
+ int sn_pos[36], sonar_valid[36];
+ int sf_quiet, sf_wait, sf_health;
+ int phase, phase_count;
+ Phase_Event phase_events[PHASE_LOG];
+ long cmd_count;
+ double sf_seen[36];
+};
+
 // Flight controls
 void Main_Thruster(double power);
 void Left_Thruster(double power);
@@ -67,12 +367,35 @@ double Angle(void);
 double RangeDist(void);
 
 
+void Lander_Reset(void);
+void Lander_Save(Lander_State *s);
+void Lander_Restore(const Lander_State *s);
+void Policy_Select(void);
+int Lander_Params_Load(const char *name, Lander_Params *p);
+int Lander_Params_Save(const char *name, const Lander_Params *p);
+int Policy_Table_Load(const char *name);
+int Policy_Table_Lookup(int thr, double dx, double dy, double vx, double vy,
+                        double ang, double *power, double *target);
+int Policy_Table_Control(void);
+int Plan_Control(void);
+void Occupancy_Reset(void);
+void Occupancy_Update(double x, double y, double ang);
+double Occupancy_Clearance(double x, double y, double dir, double range);
+void Scan_Match(double *x, double *y, double ang);
+void Thrust_Allocate(double tx, double ty, double ang, double *power);
 void Faulty_Checker(void);
+void Sonar_Update(void);
 void Setting_Up_Arrays(void);
 double Robust_Velocity_X(void);
 double Robust_Velocity_Y(void);
 double Robust_Position_X(void);
 double Robust_Position_Y(void);
+double Robust_Angle(void);
+void Angle_Update(void);
+void Motion_Update(double ang);
+void Phase_Reset(void);
+void Phase_Update(double x, double y);
+int Phase_Band(void);
 
 extern double (*Velocity_X_alt)(void);
 extern double (*Velocity_Y_alt)(void);
@@ -93,8 +416,12 @@ double Robust_Ang(void);
 
 // Function prototypes for code you need to look at
 void Lander_Control(void);
+void Lander_Coast(void);
 void Safety_Override(void);
 void Robust_Rot(double);
+void Robust_MT(double power);
+void Robust_RT(double power);
+void Robust_LT(double power);
 void vv(void);
 
 void Lander_Control_M(void);
@@ -105,6 +432,7 @@ void Safety_Override_M(void);
 void Safety_Override_L(void);
 void Safety_Override_R(void);
 void Safety_Override_N(void);
+void Safety_Override_P(void);
 
 void CondAng(double from, double to);
 
@@ -0,0 +1,195 @@
+/*
+	Headless batch runner.
+
+	Flies the flight computer in Lander.cpp against the headless simulator
+	without a display. Takes the same map/mode/component arguments as
+	Lander_Control plus:
+
+	  -n episodes   number of episodes to fly (default 10)
+	  -s seed       seed of the first episode, episode i uses seed+i
+	  -v            print one line per episode
+	  -fast         accelerated mode, see SIM_ACCEL in Lander_Sim.h
+	  -frames name  write a frame every -every ticks (default 40) to
+	                name_<seed>_<tick>.ppm, with the software renderer
+	  -crash name   write the last frame of every crash to name_<seed>.ppm
+	  -threads n    rendering threads (default one per CPU)
+	  -stages       print what each stage of Lander_Control() cost, see
+	                LANDER_STAGES in Lander_Control.h
+	  -telemetry name  publish live state to shared memory /name every
+	                tick, see Lander_Telemetry.h and Lander_Watch
+	  -phases       print the mission phase transitions of every
+	                episode, see PHASE_CRUISE in Lander_Control.h
+
+	MapName can also be proc[:seed][:WxH] for a generated map (see
+	Lander_Terrain.h), without a seed every episode gets a new one.
+
+	e.g.
+
+	     Lander_Headless hard.ppm 3 1 8 -n 50 -v
+	     Lander_Headless proc:2048x1024 2 -n 1000
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Lander_Arena.h"
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+#include "Lander_Render.h"
+#include "Lander_Terrain.h"
+#include "Lander_Telemetry.h"
+
+static double Wall_Time(void){
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The transitions Phase_Update() logged over the last episode
+static void Print_Phases(long seed){
+ int first = PHASE_COUNT > PHASE_LOG ? PHASE_COUNT - PHASE_LOG : 0;
+
+ printf("seed %ld: %d phase transitions\n", seed, PHASE_COUNT);
+ for (int i = first; i < PHASE_COUNT; i++){
+  const Phase_Event *ev = &PHASE_EVENTS[i % PHASE_LOG];
+  printf("  %7.2f s  %-8s -> %-8s  dx %5.0f  dy %5.0f\n", ev->tick * T_STEP,
+         ev->from < 0 ? "-" : PHASE_NAMES[ev->from], PHASE_NAMES[ev->to], ev->dx, ev->dy);
+ }
+}
+
+int main(int argc, char *argv[]){
+ int mode, comp[SIM_N_COMP], ncomp;
+ int episodes = 10, verbose = 0, nargs = 0, every = 40, frames = 0, outcome, stages = 0;
+ int phases = 0;
+ int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+ const char *frame_name = NULL, *crash_name = NULL, *telemetry = NULL;
+ char name[1024];
+ double render = 0;
+ long seed = 1, ticks = 0, transitions = 0;
+ char *args[SIM_N_COMP + 1];
+ int count[4] = {0, 0, 0, 0};
+ double turned = 0, wall;
+ Arena_Stats setup;
+ Sim_Sketch t_land, v_land, detect;
+ int missed = 0, false_alarms = 0;
+ Sim_Result res;
+
+ for (int i = 2; i < argc; i++){
+  if (!strcmp(argv[i], "-n") && i + 1 < argc) episodes = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atol(argv[++i]);
+  else if (!strcmp(argv[i], "-v")) verbose = 1;
+  else if (!strcmp(argv[i], "-fast")) SIM_ACCEL = 1;
+  else if (!strcmp(argv[i], "-stages")) stages = 1;
+  else if (!strcmp(argv[i], "-phases")) phases = 1;
+  else if (!strcmp(argv[i], "-telemetry") && i + 1 < argc) telemetry = argv[++i];
+  else if (!strcmp(argv[i], "-frames") && i + 1 < argc) frame_name = argv[++i];
+  else if (!strcmp(argv[i], "-every") && i + 1 < argc) every = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-crash") && i + 1 < argc) crash_name = argv[++i];
+  else if (!strcmp(argv[i], "-threads") && i + 1 < argc) threads = atoi(argv[++i]);
+  else if (nargs <= SIM_N_COMP) args[nargs++] = argv[i];
+ }
+ if (argc < 3 || !Sim_Parse_Mode(nargs, args, &mode, comp, &ncomp)){
+  fprintf(stderr, "Usage: Lander_Headless MapName FailMode [component1] ... [-n episodes] [-s seed] [-v]\n");
+  exit(1);
+ }
+ if (!Sim_Load_Map(argv[1])) exit(1);
+ if ((frame_name || crash_name) && !Render_Init("lander.ppm", threads)) exit(1);
+ if (every < 1) every = 1;
+ if (telemetry){
+  if (!Telemetry_Open(telemetry)) exit(1);
+  SIM_AFTER_CONTROL = Telemetry_Publish;
+ }
+
+ Sim_Sketch_Reset(&t_land);
+ Sim_Sketch_Reset(&v_land);
+ Sim_Sketch_Reset(&detect);
+ Lander_Stage_Clear();
+ setup = ARENA_STATS;
+ wall = Wall_Time();
+ for (int e = 0; e < episodes; e++){
+  Sim_Reset(mode, comp, ncomp, seed + e);
+  Telemetry_Run(e, episodes, seed + e, mode, count);
+  if (!frame_name && !crash_name) Sim_Run(&res);
+  else {
+   // Stepped here to keep the trail and take frames on the way
+   Render_Reset();
+   do {
+    outcome = Sim_Step();
+    Render_Track();
+    if (frame_name && SIM_TICKS % every == 0){
+     double t = Wall_Time();
+     Render_Draw();
+     render += Wall_Time() - t;
+     frames++;
+     snprintf(name, sizeof(name), "%s_%ld_%06d.ppm", frame_name, seed + e, SIM_TICKS);
+     if (!Render_Write(name)) fprintf(stderr, "Unable to write %s\n", name);
+    }
+   } while (outcome == SIM_FLYING);
+   if (crash_name && outcome == SIM_CRASHED){
+    Render_Draw();
+    snprintf(name, sizeof(name), "%s_%ld.ppm", crash_name, seed + e);
+    if (!Render_Write(name)) fprintf(stderr, "Unable to write %s\n", name);
+   }
+   Sim_Finish(outcome, &res);
+  }
+  count[res.outcome]++;
+  ticks += res.ticks;
+  turned += res.turned;
+  if (res.outcome == SIM_LANDED){
+   Sim_Sketch_Add(&t_land, res.t);
+   Sim_Sketch_Add(&v_land, fabs(res.vy));
+  }
+  for (int i = 1; i <= SIM_N_COMP; i++)
+   if (res.detect[i] >= 0) Sim_Sketch_Add(&detect, res.detect[i]);
+  missed += res.missed;
+  false_alarms += res.false_alarms;
+  if (verbose)
+   printf("seed %ld: %s t=%.2f vx=%.2f vy=%.2f ang=%.1f turned=%.0f\n", seed + e,
+          Sim_Outcome_Name(res.outcome), res.t, res.vx, res.vy, res.ang, res.turned);
+  transitions += PHASE_COUNT;
+  if (phases) Print_Phases(seed + e);
+ }
+ wall = Wall_Time() - wall;
+ Telemetry_Run(episodes, episodes, seed + episodes - 1, mode, count);
+ Telemetry_Close();
+
+ printf("%s mode %d: %d episodes, landed %d, crashed %d, timeout %d\n", argv[1], mode,
+        episodes, count[SIM_LANDED], count[SIM_CRASHED], count[SIM_TIMEOUT]);
+ if (count[SIM_LANDED]){
+  printf("mean landing time %.2f s, mean touchdown speed %.2f m/s\n",
+         Sim_Sketch_Mean(&t_land), Sim_Sketch_Mean(&v_land));
+  printf("landing time p50/p90/p99/p99.9 %.2f/%.2f/%.2f/%.2f s\n",
+         Sim_Sketch_Quantile(&t_land, .5), Sim_Sketch_Quantile(&t_land, .9),
+         Sim_Sketch_Quantile(&t_land, .99), Sim_Sketch_Quantile(&t_land, .999));
+  printf("touchdown speed p50/p90/p99/p99.9 %.2f/%.2f/%.2f/%.2f m/s\n",
+         Sim_Sketch_Quantile(&v_land, .5), Sim_Sketch_Quantile(&v_land, .9),
+         Sim_Sketch_Quantile(&v_land, .99), Sim_Sketch_Quantile(&v_land, .999));
+ }
+ if (detect.n)
+  printf("fault detection p50/p90/p99/max %.2f/%.2f/%.2f/%.2f s over %ld failed sensors\n",
+         Sim_Sketch_Quantile(&detect, .5), Sim_Sketch_Quantile(&detect, .9),
+         Sim_Sketch_Quantile(&detect, .99), detect.max, detect.n);
+ if (detect.n || missed || false_alarms)
+  printf("%d failed sensors never flagged, %d flagged that hadn't failed\n", missed, false_alarms);
+ printf("mean rotation %.0f degrees per episode\n", turned / episodes);
+ printf("wall time %.2f s (%.2f s per episode)\n", wall, wall / episodes);
+ if (SIM_ACCEL) printf("position measured on %.1f%% of ticks\n", 100.0 * SIM_MEASURED / ticks);
+ printf("terrain %dx%d: %ld tiles read, %ld of them stalling a step, %ld evicted\n", SIM_W,
+        SIM_H, TERRAIN_STATS.loads, TERRAIN_STATS.stalls, TERRAIN_STATS.evictions);
+ printf("arena: %.1f of %zu MB at most, %.2f allocations and %.2f from the heap per episode\n",
+        ARENA_STATS.peak / 1048576.0, ARENA_SIZE >> 20,
+        (double)(ARENA_STATS.allocs - setup.allocs) / episodes,
+        (double)(ARENA_STATS.heap - setup.heap) / episodes);
+ if (frames)
+  printf("rendered %d frames, %.3f ms per frame (%.0f fps) on %d threads\n", frames,
+         render * 1e3 / frames, frames / render, threads);
+ if (phases) printf("%.1f phase transitions per episode\n", (double)transitions / episodes);
+ if (stages) Lander_Stage_Report();
+ if (frame_name || crash_name) Render_Close();
+ Sim_Free_Map();
+ return 0;
+}
@@ -0,0 +1,380 @@
+/*
+	Failure combination regression matrix.
+
+	Flies every mode 3 failure combination (any non-empty subset of the
+	nine components, 511 of them) on each map for a number of seeds, in
+	parallel headless worker processes, and writes one cell per map and
+	combination with the success rate, mean and p95 landing time and the
+	mean touchdown speed and angle of the landed episodes. Landing times
+	go through quantile sketches (see Lander_Sim.h), so neither a cell
+	nor the campaign totals keep per episode samples around. So does the
+	time from a sensor failing to the flight computer flagging it, over
+	the campaign.
+
+	  -n seeds        episodes per cell (default 4), seeds seed..seed+n-1
+	  -s seed         first seed (default 1)
+	  -j workers      worker processes (default one per CPU)
+	  -k max          only combinations of at most max components
+	  -o file         JSON output (default matrix.json)
+	  -csv file       CSV output as well
+	  -diff file      compare against a JSON matrix written earlier
+
+	Maps are given as plain arguments, easy.ppm and hard.ppm by default.
+	Both outputs write the map name as given, unquoted in the CSV and
+	read back verbatim by -diff, so a name with '"', '\\', ',' or a
+	control character in it is refused.
+	With -diff every cell that landed less often, or whose mean or p95
+	landing time got more than MX_SLOWER slower, is listed and the exit
+	status is 1 if there was any. e.g.
+
+	     LANDER_POLICY=plan Lander_Matrix -n 8 -o base.json
+	     ... change the flight computer ...
+	     LANDER_POLICY=plan Lander_Matrix -n 8 -o new.json -diff base.json
+
+	The flight computer keeps its state in globals, so the workers are
+	forked processes sharing the result array, not threads.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+
+#define MX_MAX_MAPS 8
+#define MX_COMBOS ((1 << SIM_N_COMP) - 1)
+#define MX_SLOWER .1     // relative landing time increase flagged by -diff
+
+struct Mx_Cell {
+ int map, mask;
+ int count[4];
+ double t_mean, t_p95;
+ double v_touch, ang_touch;
+ int missed, false_alarms;  // sensor flags, see Sim_Result
+};
+
+// Lives in one shared mapping: the header, the cells, then three
+// sketches per worker
+struct Mx_Shared {
+ int next;        // next cell to hand out
+ int finished;
+ Sim_Sketch *t_land, *v_land, *detect;
+ Mx_Cell cell[1];
+};
+
+static const char *maps[MX_MAX_MAPS];
+static int nmaps = 0;
+
+static double Wall_Time(void){
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int Mask_Size(int mask){
+ int n = 0;
+ for (; mask; mask >>= 1) n += mask & 1;
+ return n;
+}
+
+// Component numbers of a combination, e.g. "1 4 8" with sep " "
+static void Mask_Name(int mask, const char *sep, char *s){
+ int first = 1;
+ *s = 0;
+ for (int i = 0; i < SIM_N_COMP; i++)
+  if (mask & (1 << i)){
+   s += sprintf(s, "%s%d", first ? "" : sep, i + 1);
+   first = 0;
+  }
+}
+
+// Landing time, touchdown speed and fault detection latency over the
+// whole campaign, one set of sketches per worker, merged after they all
+// exited
+static Sim_Sketch *t_land, *v_land, *detect;
+
+static void Fly_Cell(Mx_Cell *c, int seeds, long seed){
+ int comp[SIM_N_COMP], ncomp = 0;
+ Sim_Sketch t;
+ Sim_Result res;
+
+ for (int i = 0; i < SIM_N_COMP; i++)
+  if (c->mask & (1 << i)) comp[ncomp++] = i + 1;
+
+ Sim_Sketch_Reset(&t);
+ for (int e = 0; e < seeds; e++){
+  Sim_Reset(3, comp, ncomp, seed + e);
+  Sim_Run(&res);
+  if (res.outcome == SIM_LANDED){
+   Sim_Sketch_Add(&t, res.t);
+   Sim_Sketch_Add(t_land, res.t);
+   Sim_Sketch_Add(v_land, fabs(res.vy));
+   c->v_touch += fabs(res.vy);
+   c->ang_touch += res.ang;
+  }
+  for (int i = 1; i <= SIM_N_COMP; i++)
+   if (res.detect[i] >= 0) Sim_Sketch_Add(detect, res.detect[i]);
+  c->missed += res.missed;
+  c->false_alarms += res.false_alarms;
+  c->count[res.outcome]++;
+ }
+
+ int n = c->count[SIM_LANDED];
+ if (!n) return;
+ c->t_mean = Sim_Sketch_Mean(&t);
+ c->t_p95 = Sim_Sketch_Quantile(&t, .95);
+ c->v_touch /= n;
+ c->ang_touch /= n;
+}
+
+// Cells are handed out one at a time, combinations with few failures
+// finish much faster than the ones that time out
+static void Worker(Mx_Shared *sh, int w, int ncells, int seeds, long seed){
+ int loaded = -1, i;
+
+ t_land = &sh->t_land[w];
+ v_land = &sh->v_land[w];
+ detect = &sh->detect[w];
+ while ((i = __sync_fetch_and_add(&sh->next, 1)) < ncells){
+  Mx_Cell *c = &sh->cell[i];
+  if (c->map != loaded){
+   if (loaded >= 0) Sim_Free_Map();
+   if (!Sim_Load_Map(maps[c->map])) _exit(1);
+   loaded = c->map;
+  }
+  Fly_Cell(c, seeds, seed);
+  __sync_fetch_and_add(&sh->finished, 1);
+ }
+ _exit(0);
+}
+
+static double Success(const Mx_Cell *c){
+ int n = c->count[SIM_LANDED] + c->count[SIM_CRASHED] + c->count[SIM_TIMEOUT];
+ return n ? (double)c->count[SIM_LANDED] / n : 0;
+}
+
+static int Write_JSON(const char *name, Mx_Cell *cell, int ncells, int seeds, long seed){
+ FILE *f = fopen(name, "w");
+ char comps[40];
+
+ if (!f) return 0;
+ fprintf(f, "{\"seeds\": %d, \"first_seed\": %ld, \"cells\": [\n", seeds, seed);
+ for (int i = 0; i < ncells; i++){
+  Mx_Cell *c = &cell[i];
+  Mask_Name(c->mask, ", ", comps);
+  fprintf(f, " {\"map\": \"%s\", \"components\": [%s], \"landed\": %d, \"crashed\": %d, "
+          "\"timeout\": %d, \"success\": %.4f, \"t_mean\": %.3f, \"t_p95\": %.3f, "
+          "\"v_touch\": %.3f, \"ang_touch\": %.2f}%s\n",
+          maps[c->map], comps, c->count[SIM_LANDED], c->count[SIM_CRASHED],
+          c->count[SIM_TIMEOUT], Success(c), c->t_mean, c->t_p95, c->v_touch,
+          c->ang_touch, i + 1 < ncells ? "," : "");
+ }
+ fprintf(f, "]}\n");
+ fclose(f);
+ return 1;
+}
+
+static int Write_CSV(const char *name, Mx_Cell *cell, int ncells){
+ FILE *f = fopen(name, "w");
+ char comps[40];
+
+ if (!f) return 0;
+ fprintf(f, "map,components,landed,crashed,timeout,success,t_mean,t_p95,v_touch,ang_touch\n");
+ for (int i = 0; i < ncells; i++){
+  Mx_Cell *c = &cell[i];
+  Mask_Name(c->mask, " ", comps);
+  fprintf(f, "%s,%s,%d,%d,%d,%.4f,%.3f,%.3f,%.3f,%.2f\n", maps[c->map], comps,
+          c->count[SIM_LANDED], c->count[SIM_CRASHED], c->count[SIM_TIMEOUT], Success(c),
+          c->t_mean, c->t_p95, c->v_touch, c->ang_touch);
+ }
+ fclose(f);
+ return 1;
+}
+
+// Reads back the cell lines Write_JSON() produces, returns the number of
+// cells flagged against the baseline or -1 if it can't be read
+static int Diff(const char *name, Mx_Cell *cell, int ncells){
+ FILE *f = fopen(name, "r");
+ char line[512], map[256], *p;
+ double success, t_mean, t_p95;
+ int flagged = 0, matched = 0, mask, landed, crashed, timeout;
+
+ if (!f) return -1;
+ while (fgets(line, sizeof(line), f)){
+  if (sscanf(line, " {\"map\": \"%255[^\"]\", \"components\": [", map) != 1) continue;
+  p = strchr(line, '[');
+  for (mask = 0, p++; *p && *p != ']'; p++)
+   if (*p >= '1' && *p <= '9') mask |= 1 << (*p - '1');
+  p = strstr(line, "\"landed\":");
+  if (!p || sscanf(p, "\"landed\": %d, \"crashed\": %d, \"timeout\": %d",
+                   &landed, &crashed, &timeout) != 3) continue;
+  p = strstr(line, "\"success\":");
+  if (!p || sscanf(p, "\"success\": %lf, \"t_mean\": %lf, \"t_p95\": %lf",
+                   &success, &t_mean, &t_p95) != 3) continue;
+
+  for (int i = 0; i < ncells; i++){
+   Mx_Cell *c = &cell[i];
+   if (c->mask != mask || strcmp(maps[c->map], map)) continue;
+   matched++;
+   // Counts rather than the rounded rate, the seed counts may differ
+   int n = c->count[SIM_LANDED] + c->count[SIM_CRASHED] + c->count[SIM_TIMEOUT];
+   int worse = c->count[SIM_LANDED] * (landed + crashed + timeout) < landed * n;
+   int slower = landed && c->count[SIM_LANDED] &&
+                (c->t_mean > t_mean * (1 + MX_SLOWER) || c->t_p95 > t_p95 * (1 + MX_SLOWER));
+   if (worse || slower){
+    char comps[40];
+    Mask_Name(mask, " ", comps);
+    printf("%-10s [%s]:%*s success %.2f -> %.2f, t_mean %.2f -> %.2f s, t_p95 %.2f -> %.2f s%s%s\n",
+           map, comps, 18 - (int)strlen(comps), "", success, Success(c), t_mean, c->t_mean,
+           t_p95, c->t_p95, worse ? "  LESS RELIABLE" : "", slower ? "  SLOWER" : "");
+    flagged++;
+   }
+   break;
+  }
+ }
+ fclose(f);
+ printf("%d of %d cells matched in %s, %d flagged\n", matched, ncells, name, flagged);
+ return flagged;
+}
+
+// Whether a map name can go into the JSON and CSV cells as it is
+static int Plain_Name(const char *s){
+ for (; *s; s++)
+  if (*s == '"' || *s == '\\' || *s == ',' || (unsigned char)*s < ' ') return 0;
+ return 1;
+}
+
+int main(int argc, char *argv[]){
+ int seeds = 4, workers = (int)sysconf(_SC_NPROCESSORS_ONLN), max_comp = SIM_N_COMP;
+ long seed = 1;
+ const char *out = "matrix.json", *csv = NULL, *base = NULL;
+ int ncells = 0, flagged = 0;
+ double wall;
+
+ for (int i = 1; i < argc; i++){
+  if (!strcmp(argv[i], "-n") && i + 1 < argc) seeds = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atol(argv[++i]);
+  else if (!strcmp(argv[i], "-j") && i + 1 < argc) workers = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-k") && i + 1 < argc) max_comp = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-o") && i + 1 < argc) out = argv[++i];
+  else if (!strcmp(argv[i], "-csv") && i + 1 < argc) csv = argv[++i];
+  else if (!strcmp(argv[i], "-diff") && i + 1 < argc) base = argv[++i];
+  else if (argv[i][0] != '-' && nmaps < MX_MAX_MAPS) maps[nmaps++] = argv[i];
+  else {
+   fprintf(stderr, "Usage: Lander_Matrix [map ...] [-n seeds] [-s seed] [-j workers] [-k max]"
+           " [-o file.json] [-csv file.csv] [-diff baseline.json]\n");
+   exit(1);
+  }
+ }
+ for (int m = 0; m < nmaps; m++)
+  if (!Plain_Name(maps[m])){
+   fprintf(stderr, "Map name %s can't be written to the JSON or CSV as it is, rename it\n", maps[m]);
+   exit(1);
+  }
+ if (!nmaps){
+  maps[nmaps++] = "easy.ppm";
+  maps[nmaps++] = "hard.ppm";
+ }
+ if (seeds < 1) seeds = 1;
+ if (workers < 1) workers = 1;
+
+ size_t size = sizeof(Mx_Shared) + sizeof(Mx_Cell) * nmaps * MX_COMBOS
+               + sizeof(Sim_Sketch) * 3 * workers;
+ Mx_Shared *sh = (Mx_Shared *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+ if (sh == MAP_FAILED){
+  perror("mmap");
+  exit(1);
+ }
+ for (int m = 0; m < nmaps; m++)
+  for (int mask = 1; mask <= MX_COMBOS; mask++)
+   if (Mask_Size(mask) <= max_comp){
+    sh->cell[ncells].map = m;
+    sh->cell[ncells].mask = mask;
+    ncells++;
+   }
+ sh->t_land = (Sim_Sketch *)&sh->cell[nmaps * MX_COMBOS];
+ sh->v_land = sh->t_land + workers;
+ sh->detect = sh->v_land + workers;
+ for (int w = 0; w < workers; w++){
+  Sim_Sketch_Reset(&sh->t_land[w]);
+  Sim_Sketch_Reset(&sh->v_land[w]);
+  Sim_Sketch_Reset(&sh->detect[w]);
+ }
+
+ wall = Wall_Time();
+ fflush(stdout);
+ for (int w = 0; w < workers; w++)
+  if (fork() == 0) Worker(sh, w, ncells, seeds, seed);
+
+ // Progress while the workers run, until all of them have exited
+ int running = workers, status, failed = 0, tty = isatty(2);
+ while (running){
+  if (waitpid(-1, &status, WNOHANG) > 0){
+   running--;
+   if (!WIFEXITED(status) || WEXITSTATUS(status)) failed = 1;
+   continue;
+  }
+  if (tty) fprintf(stderr, "\r%d/%d cells, %.0f s", sh->finished, ncells, Wall_Time() - wall);
+  usleep(200000);
+ }
+ if (tty) fprintf(stderr, "\n");
+ if (failed || sh->finished < ncells){
+  fprintf(stderr, "A worker failed, is every map readable?\n");
+  exit(1);
+ }
+ wall = Wall_Time() - wall;
+
+ int count[4] = {0, 0, 0, 0}, missed = 0, false_alarms = 0;
+ for (int i = 0; i < ncells; i++){
+  for (int k = 1; k < 4; k++) count[k] += sh->cell[i].count[k];
+  missed += sh->cell[i].missed;
+  false_alarms += sh->cell[i].false_alarms;
+ }
+ printf("%d cells x %d seeds on %d workers: landed %d, crashed %d, timeout %d\n", ncells,
+        seeds, workers, count[SIM_LANDED], count[SIM_CRASHED], count[SIM_TIMEOUT]);
+ for (int w = 1; w < workers; w++){
+  Sim_Sketch_Merge(&sh->t_land[0], &sh->t_land[w]);
+  Sim_Sketch_Merge(&sh->v_land[0], &sh->v_land[w]);
+  Sim_Sketch_Merge(&sh->detect[0], &sh->detect[w]);
+ }
+ if (count[SIM_LANDED]){
+  printf("landing time p50/p90/p99/p99.9 %.2f/%.2f/%.2f/%.2f s\n",
+         Sim_Sketch_Quantile(sh->t_land, .5), Sim_Sketch_Quantile(sh->t_land, .9),
+         Sim_Sketch_Quantile(sh->t_land, .99), Sim_Sketch_Quantile(sh->t_land, .999));
+  printf("touchdown speed p50/p90/p99/p99.9 %.2f/%.2f/%.2f/%.2f m/s\n",
+         Sim_Sketch_Quantile(sh->v_land, .5), Sim_Sketch_Quantile(sh->v_land, .9),
+         Sim_Sketch_Quantile(sh->v_land, .99), Sim_Sketch_Quantile(sh->v_land, .999));
+ }
+ if (sh->detect->n)
+  printf("fault detection p50/p90/p99/max %.2f/%.2f/%.2f/%.2f s over %ld failed sensors\n",
+         Sim_Sketch_Quantile(sh->detect, .5), Sim_Sketch_Quantile(sh->detect, .9),
+         Sim_Sketch_Quantile(sh->detect, .99), sh->detect->max, sh->detect->n);
+ printf("%d failed sensors never flagged, %d flagged that hadn't failed\n", missed, false_alarms);
+ printf("wall time %.1f s (%.2f s per episode per worker)\n", wall,
+        wall * workers / (ncells * seeds));
+
+ if (!Write_JSON(out, sh->cell, ncells, seeds, seed)){
+  fprintf(stderr, "Unable to write %s\n", out);
+  exit(1);
+ }
+ if (csv && !Write_CSV(csv, sh->cell, ncells)){
+  fprintf(stderr, "Unable to write %s\n", csv);
+  exit(1);
+ }
+ if (base){
+  flagged = Diff(base, sh->cell, ncells);
+  if (flagged < 0){
+   fprintf(stderr, "Unable to read baseline %s\n", base);
+   exit(1);
+  }
+ }
+ munmap(sh, size);
+ return flagged > 0;
+}
@@ -0,0 +1,348 @@
+/*
+	Software renderer - see Lander_Render.h
+*/
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Lander_Arena.h"
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+#include "Lander_Render.h"
+#include "Lander_Terrain.h"
+
+// What a frame draws, set up before the bands are handed out
+struct Render_Scene {
+ double x, y, ang;
+ double s, c;                  // sin and cos of the heading
+ double sonar[36];
+ double flame[3][6];           // triangle per thruster, 0 if off
+ int x0, y0, x1, y1;           // overlay bounds, x1/y1 exclusive
+};
+
+static unsigned char *fb = NULL, *bg = NULL, *sprite = NULL;  // from the arena
+static size_t mark;
+static int fb_w, fb_h, spr_w, spr_h;
+static int view_x, view_y;       // map position of the frame's top left
+static int nthreads = 1;
+static double trail_x[RENDER_TRAIL], trail_y[RENDER_TRAIL];
+static int trail_n, trail_drawn;
+static int full;                  // next frame redraws the whole map
+static int old_x0, old_y0, old_x1, old_y1;
+static Render_Scene scene;
+static int next_band;
+
+static unsigned char *Read_PPM(const char *name, int *w, int *h){
+ FILE *f = fopen(name, "rb");
+ char line[1024];
+ int maxv, hdr = 0;
+ unsigned char *p;
+ long n;
+
+ if (!f) return NULL;
+ while (hdr < 3 && fgets(line, 1024, f)){
+  if (line[0] == '#') continue;
+  if (hdr == 0 && strncmp(line, "P6", 2) == 0) hdr = 1;
+  else if (hdr == 1 && sscanf(line, "%d %d", w, h) == 2) hdr = 2;
+  else if (hdr == 2 && sscanf(line, "%d", &maxv) == 1) hdr = 3;
+ }
+ n = (long)*w * *h * 3;
+ p = hdr == 3 && *w > 0 && *h > 0 ? (unsigned char *)Arena_Alloc(n) : NULL;
+ if (p && (long)fread(p, 1, n, f) != n) p = NULL;
+ fclose(f);
+ return p;
+}
+
+int Render_Init(const char *name, int threads){
+ mark = Arena_Mark();
+ sprite = Read_PPM(name, &spr_w, &spr_h);
+ if (!sprite){
+  fprintf(stderr, "Unable to read lander sprite %s\n", name);
+  Arena_Release(mark);
+  return 0;
+ }
+ nthreads = threads < 1 ? 1 : threads > RENDER_MAX_THREADS ? RENDER_MAX_THREADS : threads;
+ Render_Reset();
+ return 1;
+}
+
+void Render_Close(void){
+ if (sprite) Arena_Release(mark);
+ fb = bg = sprite = NULL;
+}
+
+static int View_Size(int n){
+ return n < RENDER_VIEW ? n : RENDER_VIEW;
+}
+
+void Render_Reset(void){
+ // A bigger map means bigger buffers, the old ones stay in the arena
+ // until Render_Close()
+ if (!fb || fb_w != View_Size(SIM_W) || fb_h != View_Size(SIM_H)){
+  fb_w = View_Size(SIM_W);
+  fb_h = View_Size(SIM_H);
+  fb = (unsigned char *)Arena_Alloc((size_t)fb_w * fb_h * 3);
+  bg = (unsigned char *)Arena_Alloc((size_t)fb_w * fb_h * 3);
+ }
+ view_x = view_y = -1;
+ trail_n = trail_drawn = 0;
+ full = 1;
+}
+
+// Start of the window along one axis: unchanged while p stays in its
+// middle half, else centred on p
+static int View_Start(int v, int size, int map, double p){
+ if (v >= 0 && p >= v + size / 4 && p < v + size - size / 4) return v;
+ v = (int)lround(p) - size / 2;
+ if (v > map - size) v = map - size;
+ return v < 0 ? 0 : v;
+}
+
+static void Move_View(void){
+ Sim_Lander l;
+ int x, y;
+
+ Sim_Get_Lander(&l);
+ x = View_Start(view_x, fb_w, SIM_W, l.x);
+ y = View_Start(view_y, fb_h, SIM_H, l.y);
+ if (x == view_x && y == view_y) return;
+ view_x = x;
+ view_y = y;
+ for (int r = 0; r < fb_h; r++) Terrain_Row(view_y + r, view_x, fb_w, bg + (size_t)r * fb_w * 3);
+ full = 1;
+}
+
+void Render_Track(void){
+ Sim_Lander l;
+
+ // A dropped point would stay painted, start over from the map instead
+ if (trail_n == RENDER_TRAIL){
+  memmove(trail_x, trail_x + RENDER_TRAIL / 2, sizeof(double) * RENDER_TRAIL / 2);
+  memmove(trail_y, trail_y + RENDER_TRAIL / 2, sizeof(double) * RENDER_TRAIL / 2);
+  trail_n = RENDER_TRAIL / 2;
+  full = 1;
+ }
+ Sim_Get_Lander(&l);
+ trail_x[trail_n] = l.x;
+ trail_y[trail_n] = l.y;
+ trail_n++;
+}
+
+static inline void Put(int x, int y, int r, int g, int b){
+ unsigned char *p = fb + 3 * ((long)y * fb_w + x);
+ p[0] = r;
+ p[1] = g;
+ p[2] = b;
+}
+
+// Flame behind a thruster: exhaust direction (ex, ey) in screen terms,
+// nozzle dist px from the centre, length grows with power
+static void Flame(double *t, double ex, double ey, double dist, double power){
+ double len = 8 + 24 * power, w = 5;
+ double nx = scene.x + ex * dist, ny = scene.y + ey * dist;
+
+ t[0] = nx - ey * w;
+ t[1] = ny + ex * w;
+ t[2] = nx + ey * w;
+ t[3] = ny - ex * w;
+ t[4] = nx + ex * len;
+ t[5] = ny + ey * len;
+}
+
+static void Grow(int *x0, int *y0, int *x1, int *y1, double x, double y){
+ if (x < *x0) *x0 = (int)floor(x);
+ if (y < *y0) *y0 = (int)floor(y);
+ if (x + 1 > *x1) *x1 = (int)ceil(x + 1);
+ if (y + 1 > *y1) *y1 = (int)ceil(y + 1);
+}
+
+static void Setup_Scene(void){
+ Sim_Lander l;
+ double r = .5 * sqrt((double)spr_w * spr_w + spr_h * spr_h) + 1;
+ Render_Scene *s = &scene;
+
+ Sim_Get_Lander(&l);
+ l.x -= view_x;
+ l.y -= view_y;
+ s->x = l.x;
+ s->y = l.y;
+ s->ang = l.ang;
+ s->s = sin(l.ang);
+ s->c = cos(l.ang);
+ memcpy(s->sonar, SONAR_DIST, sizeof(s->sonar));
+ s->x0 = (int)floor(l.x - r);
+ s->y0 = (int)floor(l.y - r);
+ s->x1 = (int)ceil(l.x + r);
+ s->y1 = (int)ceil(l.y + r);
+
+ // Exhaust leaves opposite to the thrust: down the lander's axis for
+ // the main thruster, sideways for the others
+ memset(s->flame, 0, sizeof(s->flame));
+ if (l.mt > .01) Flame(s->flame[0], -s->s, s->c, 18, l.mt);
+ if (l.rt > .01) Flame(s->flame[1], s->c, s->s, 20, l.rt);
+ if (l.lt > .01) Flame(s->flame[2], -s->c, -s->s, 20, l.lt);
+ for (int k = 0; k < 3; k++)
+  if (s->flame[k][4] != 0 || s->flame[k][5] != 0)
+   for (int v = 0; v < 3; v++) Grow(&s->x0, &s->y0, &s->x1, &s->y1, s->flame[k][2 * v], s->flame[k][2 * v + 1]);
+ for (int i = 0; i < 36; i++)
+  if (s->sonar[i] > 0){
+   double a = l.ang + i * 10.0 * PI / 180.0;
+   double ex = l.x + s->sonar[i] * sin(a), ey = l.y - s->sonar[i] * cos(a);
+   // The end of a ray gets a 3x3 marker
+   Grow(&s->x0, &s->y0, &s->x1, &s->y1, ex - 2, ey - 2);
+   Grow(&s->x0, &s->y0, &s->x1, &s->y1, ex + 2, ey + 2);
+  }
+ if (s->x0 < 0) s->x0 = 0;
+ if (s->y0 < 0) s->y0 = 0;
+ if (s->x1 > fb_w) s->x1 = fb_w;
+ if (s->y1 > fb_h) s->y1 = fb_h;
+}
+
+// Sonar return i drawn over rows [y0, y1)
+static void Ray(int i, int y0, int y1){
+ double a = scene.ang + i * 10.0 * PI / 180.0, dx = sin(a), dy = -cos(a);
+ double k0 = 0, k1 = scene.sonar[i];
+
+ // Steps along the ray that fall in the band
+ if (fabs(dy) > 1e-9){
+  double ka = (y0 - .5 - scene.y) / dy, kb = (y1 - .5 - scene.y) / dy;
+  k0 = fmax(k0, fmin(ka, kb) - 1);
+  k1 = fmin(k1, fmax(ka, kb) + 1);
+ }
+ else if (scene.y < y0 - .5 || scene.y >= y1 - .5) return;
+ for (double k = ceil(fmax(k0, 0)); k <= k1; k++){
+  int px = (int)lround(scene.x + k * dx), py = (int)lround(scene.y + k * dy);
+  if (py >= y0 && py < y1 && px >= 0 && px < fb_w) Put(px, py, 0, 200, 0);
+ }
+ for (int ox = -1; ox <= 1; ox++)
+  for (int oy = -1; oy <= 1; oy++){
+   int px = (int)lround(scene.x + scene.sonar[i] * dx) + ox;
+   int py = (int)lround(scene.y + scene.sonar[i] * dy) + oy;
+   if (py >= y0 && py < y1 && px >= 0 && px < fb_w) Put(px, py, 120, 255, 120);
+  }
+}
+
+static void Triangle(const double *t, int y0, int y1){
+ double minx = fmin(t[0], fmin(t[2], t[4])), maxx = fmax(t[0], fmax(t[2], t[4]));
+ double miny = fmin(t[1], fmin(t[3], t[5])), maxy = fmax(t[1], fmax(t[3], t[5]));
+ double area = (t[2] - t[0]) * (t[5] - t[1]) - (t[3] - t[1]) * (t[4] - t[0]);
+ int xa = (int)fmax(0, floor(minx)), xb = (int)fmin(fb_w - 1, ceil(maxx));
+ int ya = (int)fmax(y0, floor(miny)), yb = (int)fmin(y1 - 1, ceil(maxy));
+
+ if (fabs(area) < 1e-9) return;
+ for (int y = ya; y <= yb; y++)
+  for (int x = xa; x <= xb; x++){
+   double px = x + .5, py = y + .5;
+   double w0 = ((t[2] - px) * (t[5] - py) - (t[3] - py) * (t[4] - px)) / area;
+   double w1 = ((t[4] - px) * (t[1] - py) - (t[5] - py) * (t[0] - px)) / area;
+   double w2 = 1 - w0 - w1;
+   if (w0 < 0 || w1 < 0 || w2 < 0) continue;
+   // Hot at the nozzle, red at the tip
+   Put(x, y, 255, (int)(80 + 175 * (w0 + w1)), (int)(60 * (w0 + w1)));
+  }
+}
+
+static void Sprite(int y0, int y1){
+ int r = (int)ceil(.5 * sqrt((double)spr_w * spr_w + spr_h * spr_h));
+ int xa = (int)fmax(0, floor(scene.x - r)), xb = (int)fmin(fb_w - 1, ceil(scene.x + r));
+ int ya = (int)fmax(y0, floor(scene.y - r)), yb = (int)fmin(y1 - 1, ceil(scene.y + r));
+
+ for (int y = ya; y <= yb; y++)
+  for (int x = xa; x <= xb; x++){
+   // Screen offset rotated back into the sprite, which is drawn
+   // turned clockwise by the heading
+   double dx = x - scene.x, dy = y - scene.y;
+   int u = (int)floor(dx * scene.c + dy * scene.s + spr_w / 2.0);
+   int v = (int)floor(-dx * scene.s + dy * scene.c + spr_h / 2.0);
+   if (u < 0 || v < 0 || u >= spr_w || v >= spr_h) continue;
+   unsigned char *p = sprite + 3 * (v * spr_w + u);
+   if (p[0] + p[1] + p[2] < 30) continue;
+   Put(x, y, p[0], p[1], p[2]);
+  }
+}
+
+static void Band(int y0, int y1){
+ size_t row = (size_t)fb_w * 3;
+
+ // Map back under the previous frame's overlays
+ if (full) memcpy(fb + y0 * row, bg + y0 * row, (y1 - y0) * row);
+ else
+  for (int y = y0 > old_y0 ? y0 : old_y0; y < y1 && y < old_y1; y++)
+   memcpy(fb + y * row + old_x0 * 3, bg + y * row + old_x0 * 3, (old_x1 - old_x0) * 3);
+
+ for (int i = 0; i < trail_n; i++){
+  int x = (int)lround(trail_x[i]) - view_x, y = (int)lround(trail_y[i]) - view_y;
+  if (y < y0 || y >= y1 || x < 0 || x >= fb_w) continue;
+  if (full || i >= trail_drawn || (x >= old_x0 && x < old_x1 && y >= old_y0 && y < old_y1))
+   Put(x, y, 255, 220, 0);
+ }
+ if (y1 <= scene.y0 || y0 >= scene.y1) return;
+ for (int i = 0; i < 36; i++)
+  if (scene.sonar[i] > 0) Ray(i, y0, y1);
+ for (int k = 0; k < 3; k++)
+  if (scene.flame[k][4] != 0 || scene.flame[k][5] != 0) Triangle(scene.flame[k], y0, y1);
+ Sprite(y0, y1);
+}
+
+static void *Band_Worker(void *arg){
+ int b, nbands = (fb_h + RENDER_BAND - 1) / RENDER_BAND;
+
+ (void)arg;
+ while ((b = __sync_fetch_and_add(&next_band, 1)) < nbands)
+  Band(b * RENDER_BAND, b * RENDER_BAND + RENDER_BAND < fb_h ? b * RENDER_BAND + RENDER_BAND : fb_h);
+ return NULL;
+}
+
+void Render_Draw(void){
+ pthread_t th[RENDER_MAX_THREADS];
+ int started = 0;
+
+ if (!fb || fb_w != View_Size(SIM_W) || fb_h != View_Size(SIM_H)) Render_Reset();
+ Move_View();
+ Setup_Scene();
+ next_band = 0;
+ for (int i = 1; i < nthreads; i++)
+  if (!pthread_create(&th[started], NULL, Band_Worker, NULL)) started++;
+ Band_Worker(NULL);
+ for (int i = 0; i < started; i++) pthread_join(th[i], NULL);
+
+ full = 0;
+ trail_drawn = trail_n;
+ old_x0 = scene.x0;
+ old_y0 = scene.y0;
+ old_x1 = scene.x1;
+ old_y1 = scene.y1;
+}
+
+const unsigned char *Render_Pixels(void){
+ return fb;
+}
+
+static int Write_All(int fd, const void *p, size_t n){
+ const char *c = (const char *)p;
+ ssize_t k;
+
+ while (n > 0){
+  if ((k = write(fd, c, n)) <= 0) return 0;
+  c += k;
+  n -= (size_t)k;
+ }
+ return 1;
+}
+
+// Straight to the file descriptor, stdio would allocate a buffer for
+// every frame
+int Render_Write(const char *name){
+ char hdr[64];
+ int n = snprintf(hdr, sizeof(hdr), "P6\n%d %d\n255\n", fb_w, fb_h);
+ int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644), ok;
+
+ if (fd < 0) return 0;
+ ok = Write_All(fd, hdr, n) && Write_All(fd, fb, (size_t)fb_w * fb_h * 3);
+ return close(fd) == 0 && ok;
+}
@@ -0,0 +1,32 @@
+#ifndef _LANDER_RENDER_H
+#define _LANDER_RENDER_H
+
+/*
+  Software renderer for the headless simulator.
+
+  Composites the map, the lander's trail, the sonar returns, the thrust
+  flames and the rotated lander sprite (lander.ppm, black is
+  transparent) into an RGB framebuffer the size of the map, without GL
+  or a display. The map is copied in once; after that each frame puts
+  back the map under what the previous frame drew and draws the
+  overlays again, so a frame costs the overlays, not the map.
+
+  The frame is cut into bands of RENDER_BAND rows that worker threads
+  take one at a time. Every band is restored and drawn by exactly one
+  thread, clipping each overlay to its rows, so no locking is needed.
+*/
+
+#define RENDER_BAND 32
+#define RENDER_MAX_THREADS 16
+#define RENDER_TRAIL 4096     // trail points kept, oldest dropped first
+#define RENDER_VIEW 1024      // largest frame, px
+
+int Render_Init(const char *sprite, int threads);
+void Render_Close(void);
+void Render_Reset(void);        // new episode: forget the trail, redraw all
+void Render_Track(void);        // adds the lander's position to the trail
+void Render_Draw(void);         // current simulator state into the framebuffer
+const unsigned char *Render_Pixels(void);
+int Render_Write(const char *name);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+	Shadow mode A/B runs.
+
+	Flies the flight computer as configured (LANDER_POLICY, LANDER_PARAMS)
+	and runs a candidate configuration alongside it without actuating
+	it. Every tick the candidate gets the simulator exactly as the live
+	controller is about to see it, sensor noise stream included: the
+	simulator is snapshotted, the candidate's own flight computer state
+	swapped in and run, and everything restored before the live
+	controller runs. The live flight is therefore the same as without a
+	shadow, and both controllers' commands and CPU time are compared on
+	every tick of it. Takes the same map/mode/component arguments as
+	Lander_Headless plus:
+
+	  -cand policy[:params]  candidate: live, table, plan or code,
+	                         optionally with a parameter file (default
+	                         live)
+	  -n episodes            number of episodes (default 10)
+	  -s seed                seed of the first episode
+	  -log file              per tick CSV of both command sets and costs
+	  -v                     print one line per episode
+
+	e.g.
+
+	     Lander_Shadow hard.ppm 1 -cand live:tuned.params -n 20
+
+	A change to the policy code itself is shadowed as "code": copy
+	Lander_Control_M/R/L with their phase handlers (Control_M_* and so
+	on), or just the ones being changed, into a file that includes
+	Lander_Control.h, change them there and build with
+
+	     make Lander_Shadow CANDIDATE=file.cpp
+
+	The copies are compiled as Cand_Control_M/R/L and swapped into
+	LANDER_POLICIES for the candidate's part of each tick; a policy not
+	in the file is the live one. Only the policies can be changed this
+	way, the estimators, the safety override and everything else
+	Lander.cpp holds are shared with the live controller, and a copy
+	can only use what Lander_Control.h declares.
+
+	Both controllers draw their sensor readings from the same noise
+	stream, a reading taken by one and not the other shifts the ones
+	after it, as with any change to the controller.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+
+#define SH_THRUST .1     // thrust difference counted as diverging
+#define SH_HEADING 5.0   // heading target difference (degrees) counted as diverging
+
+static Sim_Snapshot snap;
+static Lander_State shadow_fc;
+static Sim_Command shadow_cmd;
+static Lander_Params live_params, cand_params;
+static int live_mode, cand_mode;
+static double t_start, t_cand;
+static Sim_Sketch cost_live, cost_cand;
+static FILE *tick_log = NULL;
+static int episode;
+
+// The candidate's policies with -cand code, linked in from CANDIDATE
+// (see the Makefile); null when it isn't in the file
+extern void Cand_Control_M(void) __attribute__((weak));
+extern void Cand_Control_R(void) __attribute__((weak));
+extern void Cand_Control_L(void) __attribute__((weak));
+static void (*live_policies[PT_NTHR])(void), (*cand_policies[PT_NTHR])(void);
+
+// Per episode divergence
+static long ticks, diverged;
+static double d_thrust, d_heading, first_diverged;
+
+static double Now(void){
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Run_Candidate(void){
+ Lander_Stage stages[STAGE_N];
+ Lander_Tick tick = LANDER_TICK;
+ Safety_Stats safety = SAFETY_STATS;
+ double t;
+
+ // Stage timings and override counts stay the live controller's alone
+ memcpy(stages, LANDER_STAGES, sizeof(stages));
+ Sim_Save(&snap);
+ Lander_Restore(&shadow_fc);
+ SIM_CMD = shadow_cmd;
+ POLICY_MODE = cand_mode;
+ LANDER_PARAMS = cand_params;
+ memcpy(LANDER_POLICIES, cand_policies, sizeof(cand_policies));
+
+ t = Now();
+ Lander_Control();
+ Safety_Override();
+ t_cand = Now() - t;
+
+ shadow_cmd = SIM_CMD;
+ Lander_Save(&shadow_fc);
+ POLICY_MODE = live_mode;
+ LANDER_PARAMS = live_params;
+ memcpy(LANDER_POLICIES, live_policies, sizeof(live_policies));
+ memcpy(LANDER_STAGES, stages, sizeof(stages));
+ LANDER_TICK = tick;
+ SAFETY_STATS = safety;
+ Sim_Restore(&snap);
+ t_start = Now();
+}
+
+static void Compare(void){
+ double t_live = Now() - t_start;
+ double dt[3] = {fabs(SIM_CMD.mt - shadow_cmd.mt), fabs(SIM_CMD.rt - shadow_cmd.rt),
+                 fabs(SIM_CMD.lt - shadow_cmd.lt)};
+ double dh = fabs(fmod(SIM_CMD.heading - shadow_cmd.heading + 540, 360) - 180);
+ double dmax = fmax(dt[0], fmax(dt[1], dt[2]));
+
+ Sim_Sketch_Add(&cost_live, t_live * 1e6);
+ Sim_Sketch_Add(&cost_cand, t_cand * 1e6);
+ ticks++;
+ d_thrust += dt[0] + dt[1] + dt[2];
+ d_heading += dh;
+ if (dmax > SH_THRUST || dh > SH_HEADING){
+  if (!diverged) first_diverged = SIM_TIME;
+  diverged++;
+ }
+ if (tick_log)
+  fprintf(tick_log, "%d,%d,%.3f,%.3f,%.3f,%.3f,%.1f,%.3f,%.3f,%.3f,%.1f,%.2f,%.2f\n", episode,
+          SIM_TICKS, SIM_TIME, SIM_CMD.mt, SIM_CMD.rt, SIM_CMD.lt, SIM_CMD.heading,
+          shadow_cmd.mt, shadow_cmd.rt, shadow_cmd.lt, shadow_cmd.heading, t_live * 1e6,
+          t_cand * 1e6);
+}
+
+// "policy[:params]" into a policy mode and parameters
+static int Parse_Candidate(const char *spec, int *mode, Lander_Params *p){
+ char name[16];
+ const char *colon = strchr(spec, ':');
+ size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+ if (len >= sizeof(name)) return 0;
+ memcpy(name, spec, len);
+ name[len] = 0;
+ if (!strcmp(name, "live")) *mode = POLICY_LIVE;
+ else if (!strcmp(name, "code")){
+  void (*code[PT_NTHR])(void) = {Cand_Control_M, Cand_Control_R, Cand_Control_L};
+  int found = 0;
+  for (int i = 0; i < PT_NTHR; i++)
+   if (code[i]){
+    cand_policies[i] = code[i];
+    found = 1;
+   }
+  if (!found){
+   fprintf(stderr, "No candidate policies linked in, build with make CANDIDATE=file.cpp\n");
+   return 0;
+  }
+  *mode = POLICY_LIVE;
+ }
+ else if (!strcmp(name, "plan")) *mode = POLICY_PLAN;
+ else if (!strcmp(name, "table")){
+  const char *table = getenv("LANDER_POLICY_TABLE");
+  if (!Policy_Table_Load(table ? table : "policy_table.bin")) return 0;
+  *mode = POLICY_TABLE;
+ }
+ else return 0;
+ return !colon || Lander_Params_Load(colon + 1, p);
+}
+
+int main(int argc, char *argv[]){
+ int mode, comp[SIM_N_COMP], ncomp;
+ int episodes = 10, verbose = 0, nargs = 0;
+ long seed = 1;
+ const char *cand = "live", *log_name = NULL;
+ char *args[SIM_N_COMP + 1];
+ long all_ticks = 0, all_diverged = 0;
+ int count[4] = {0, 0, 0, 0};
+ Sim_Result res;
+
+ for (int i = 2; i < argc; i++){
+  if (!strcmp(argv[i], "-n") && i + 1 < argc) episodes = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atol(argv[++i]);
+  else if (!strcmp(argv[i], "-cand") && i + 1 < argc) cand = argv[++i];
+  else if (!strcmp(argv[i], "-log") && i + 1 < argc) log_name = argv[++i];
+  else if (!strcmp(argv[i], "-v")) verbose = 1;
+  else if (nargs <= SIM_N_COMP) args[nargs++] = argv[i];
+ }
+ if (argc < 3 || !Sim_Parse_Mode(nargs, args, &mode, comp, &ncomp)){
+  fprintf(stderr, "Usage: Lander_Shadow MapName FailMode [component1] ... [-cand policy[:params]]"
+          " [-n episodes] [-s seed] [-log file] [-v]\n");
+  exit(1);
+ }
+ if (!Sim_Load_Map(argv[1])) exit(1);
+
+ // The live configuration comes from the environment as usual
+ Policy_Select();
+ live_mode = POLICY_MODE;
+ live_params = LANDER_PARAMS;
+ cand_params = LANDER_PARAMS_DEFAULT;
+ memcpy(live_policies, LANDER_POLICIES, sizeof(live_policies));
+ memcpy(cand_policies, LANDER_POLICIES, sizeof(cand_policies));
+ if (!Parse_Candidate(cand, &cand_mode, &cand_params)){
+  fprintf(stderr, "Unable to set up candidate %s\n", cand);
+  exit(1);
+ }
+ if (log_name){
+  tick_log = fopen(log_name, "w");
+  if (!tick_log){
+   fprintf(stderr, "Unable to write %s\n", log_name);
+   exit(1);
+  }
+  fprintf(tick_log, "episode,tick,t,mt,rt,lt,heading,cand_mt,cand_rt,cand_lt,cand_heading,"
+          "live_us,cand_us\n");
+ }
+
+ Sim_Sketch_Reset(&cost_live);
+ Sim_Sketch_Reset(&cost_cand);
+ SIM_BEFORE_CONTROL = Run_Candidate;
+ SIM_AFTER_CONTROL = Compare;
+ for (episode = 0; episode < episodes; episode++){
+  Sim_Reset(mode, comp, ncomp, seed + episode);
+  Lander_Save(&shadow_fc);
+  shadow_cmd = SIM_CMD;
+  ticks = diverged = 0;
+  d_thrust = d_heading = 0;
+  Sim_Run(&res);
+  count[res.outcome]++;
+  all_ticks += ticks;
+  all_diverged += diverged;
+  if (verbose){
+   printf("seed %ld: %s t=%.2f, diverged on %.1f%% of ticks", seed + episode,
+          Sim_Outcome_Name(res.outcome), res.t, 100.0 * diverged / ticks);
+   if (diverged) printf(" from %.2f s", first_diverged);
+   printf(", mean |thrust diff| %.3f, mean |heading diff| %.1f deg\n", d_thrust / ticks,
+          d_heading / ticks);
+  }
+ }
+ if (tick_log) fclose(tick_log);
+
+ printf("%s mode %d, %d episodes: landed %d, crashed %d, timeout %d (live controller)\n",
+        argv[1], mode, episodes, count[SIM_LANDED], count[SIM_CRASHED], count[SIM_TIMEOUT]);
+ printf("candidate %s diverged on %.1f%% of %ld ticks (thrust > %.2f or heading > %.0f deg)\n",
+        cand, 100.0 * all_diverged / all_ticks, all_ticks, SH_THRUST, SH_HEADING);
+ printf("cost per tick, us p50/p99/p99.9: live %.1f/%.1f/%.1f, candidate %.1f/%.1f/%.1f\n",
+        Sim_Sketch_Quantile(&cost_live, .5), Sim_Sketch_Quantile(&cost_live, .99),
+        Sim_Sketch_Quantile(&cost_live, .999), Sim_Sketch_Quantile(&cost_cand, .5),
+        Sim_Sketch_Quantile(&cost_cand, .99), Sim_Sketch_Quantile(&cost_cand, .999));
+ printf("mean cost per tick: live %.1f us, candidate %.1f us\n", Sim_Sketch_Mean(&cost_live),
+        Sim_Sketch_Mean(&cost_cand));
+ Sim_Free_Map();
+ return 0;
+}
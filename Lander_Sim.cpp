@@ -0,0 +1,629 @@
+/*
+	Headless simulator - see Lander_Sim.h
+
+	Provides the same globals and flight functions as Lander_Control.o so
+	Lander.cpp links against either one unchanged.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Lander_Arena.h"
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+#include "Lander_Terrain.h"
+
+// Globals the flight computer sees (owned by the simulator)
+int MT_OK = 1;
+int RT_OK = 1;
+int LT_OK = 1;
+double PLAT_X = -1;
+double PLAT_Y = -1;
+double SONAR_DIST[36];
+
+int SIM_W = 0;
+int SIM_H = 0;
+double SIM_TIME_LIMIT = SIM_MAX_TIME;
+int SIM_NOISE = 1;
+int SIM_ACCEL = 0;
+long SIM_MEASURED = 0;
+int SIM_COMP_OK[SIM_N_COMP + 1];
+double SIM_FAIL_TIME = -1;
+double SIM_TIME = 0;
+int SIM_TICKS = 0;
+int SIM_ROT_SET = 0;
+Sim_Command SIM_CMD;
+void (*SIM_BEFORE_CONTROL)(void) = NULL;
+void (*SIM_AFTER_CONTROL)(void) = NULL;
+
+static Sim_Lander lander;
+static int fail_comp[SIM_N_COMP + 1];
+static int fail_done;
+static double ping_time;
+static double ping_r[36];
+static int ping_hit[36];
+static double rot_total;
+static int proc_each, proc_w, proc_h;   // new generated map every episode
+static int coast_left;                  // ticks left to dead reckon for
+static Sim_Command coast_cmd;           // commands of the tick before
+static double flag_drop[SIM_N_COMP + 1]; // when the sensor's *_OK flag dropped, -1 not yet
+
+static unsigned long long rng = 1;
+
+// xorshift64* - much cheaper than drand48() for the millions of sensor
+// reads per second the flight computer makes, and its whole state is
+// one word
+double Sim_Rand(void){
+ rng ^= rng >> 12;
+ rng ^= rng << 25;
+ rng ^= rng >> 27;
+ return ((rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void Sim_Seed(long seed){
+ // splitmix64 so that consecutive seeds give unrelated streams
+ unsigned long long z = (unsigned long long)seed + 0x9e3779b97f4a7c15ULL;
+ z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+ z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+ rng = (z ^ (z >> 31)) | 1;
+}
+
+static inline int Platform_Pixel(const unsigned char *p){
+ return p[0] > 200 && p[1] < 60 && p[2] < 60;
+}
+
+static double Noise(double scale){
+ if (!SIM_NOISE) return 0;
+ return (Sim_Rand() - .5) * scale;
+}
+
+// "proc[:seed][:WxH]": a generated map, one per episode seed if no
+// seed is given
+static int Parse_Proc(const char *spec){
+ int w = 1024, h = 1024;
+ long seed = 0;
+ int have_seed = 0;
+
+ while (*spec == ':'){
+  spec++;
+  if (strchr(spec, 'x') && (!strchr(spec, ':') || strchr(spec, 'x') < strchr(spec, ':'))){
+   if (sscanf(spec, "%dx%d", &w, &h) != 2) break;
+  }
+  else if (sscanf(spec, "%ld", &seed) == 1) have_seed = 1;
+  else break;
+  spec += strcspn(spec, ":");
+ }
+ if (*spec){
+  fprintf(stderr, "Bad procedural map %s, expected proc[:seed][:WxH]\n", spec);
+  return 0;
+ }
+ proc_w = w;
+ proc_h = h;
+ proc_each = !have_seed;
+ return Sim_Generate_Map(seed, w, h);
+}
+
+int Sim_Generate_Map(long seed, int w, int h){
+ double px, py;
+
+ if (!Terrain_Generate(seed, w, h, &px, &py)) return 0;
+ SIM_W = w;
+ SIM_H = h;
+ SIM_TIME_LIMIT = SIM_MAX_TIME * fmax(1, fmax(w, h) / 1024.0);
+ PLAT_X = px;
+ PLAT_Y = py;
+ return 1;
+}
+
+int Sim_Load_Map(const char *name){
+ int w, h;
+ long xs = 0, cnt = 0;
+ unsigned char *row;
+
+ Sim_Free_Map();
+ if (!strncmp(name, "proc", 4) && (!name[4] || name[4] == ':')) return Parse_Proc(name + 4);
+ if (!Terrain_Open(name, &w, &h)) return 0;
+ SIM_W = w;
+ SIM_H = h;
+ SIM_TIME_LIMIT = SIM_MAX_TIME * fmax(1, fmax(w, h) / 1024.0);
+
+ // Platform: centre of the red pixels, top edge for PLAT_Y. Read
+ // through once a row at a time, past the tile cache.
+ PLAT_Y = h;
+ row = (unsigned char *)Arena_Scratch((size_t)w * 3);
+ for (int y = 0; row && y < h; y++){
+  if (!Terrain_Stream(y, row)) break;
+  for (int x = 0; x < w; x++)
+   if (Platform_Pixel(row + 3 * x)){
+    xs += x;
+    cnt++;
+    if (y < PLAT_Y) PLAT_Y = y;
+   }
+ }
+ if (!cnt){
+  fprintf(stderr, "No landing platform in %s\n", name);
+  Sim_Free_Map();
+  return 0;
+ }
+ PLAT_X = (double)xs / cnt;
+ return 1;
+}
+
+void Sim_Free_Map(void){
+ Terrain_Close();
+ proc_each = 0;
+ SIM_W = SIM_H = 0;
+}
+
+// Same test RangeDist() uses in the GUI simulator
+int Sim_Terrain(int x, int y){
+ const unsigned char *p = Terrain_Pixel(x, y);
+ return p && p[0] > 5;
+}
+
+int Sim_Platform(int x, int y){
+ const unsigned char *p = Terrain_Pixel(x, y);
+ return p && Platform_Pixel(p);
+}
+
+static void Apply_Failures(void){
+ for (int i = 1; i <= SIM_N_COMP; i++)
+  if (fail_comp[i]) SIM_COMP_OK[i] = 0;
+ MT_OK = SIM_COMP_OK[1];
+ LT_OK = SIM_COMP_OK[2];
+ RT_OK = SIM_COMP_OK[3];
+ fail_done = 1;
+}
+
+void Sim_Reset(int mode, const int *comp, int ncomp, long seed){
+ Arena_Episode();
+ if (proc_each) Sim_Generate_Map(seed, proc_w, proc_h);
+ Sim_Seed(seed);
+
+ memset(&lander, 0, sizeof(lander));
+ lander.x = Sim_Rand() * (SIM_W - 99.0) + 50.0;
+ lander.y = Sim_Rand() * 50.0 + 50.0;
+ lander.vx = Sim_Rand() * 25.0 - 12.5;
+ lander.vy = -Sim_Rand() * 15.0;
+ lander.ang = Sim_Rand() * 2 * PI;
+
+ for (int i = 0; i <= SIM_N_COMP; i++){
+  SIM_COMP_OK[i] = 1;
+  fail_comp[i] = 0;
+ }
+ MT_OK = RT_OK = LT_OK = 1;
+
+ // Failure schedule. Mode 1 loses one thruster, mode 2 a thruster and
+ // a sensor, mode 3 exactly the listed components.
+ if (mode == 1 || mode == 2) fail_comp[1 + (int)(Sim_Rand() * 3)] = 1;
+ if (mode == 2) fail_comp[4 + (int)(Sim_Rand() * 6)] = 1;
+ if (mode == 3)
+  for (int i = 0; i < ncomp; i++)
+   if (comp[i] >= 1 && comp[i] <= SIM_N_COMP) fail_comp[comp[i]] = 1;
+ SIM_FAIL_TIME = mode ? .5 + Sim_Rand() * 4.5 : -1;
+ fail_done = 0;
+
+ ping_time = 0;
+ for (int i = 0; i < 36; i++){
+  SONAR_DIST[i] = -1;
+  ping_r[i] = SIM_SONAR_START;
+  ping_hit[i] = 0;
+ }
+ SIM_TIME = 0;
+ SIM_TICKS = 0;
+ rot_total = 0;
+ Sim_Clear_Commands();
+ coast_left = 0;
+ coast_cmd = SIM_CMD;
+ for (int i = 0; i <= SIM_N_COMP; i++) flag_drop[i] = -1;
+
+ Lander_Reset();
+}
+
+void Sim_Set_Lander(const Sim_Lander *l){
+ lander = *l;
+}
+
+void Sim_Get_Lander(Sim_Lander *l){
+ *l = lander;
+}
+
+void Sim_Clear_Commands(void){
+ lander.mt = lander.lt = lander.rt = 0;
+ lander.rot = 0;
+ SIM_ROT_SET = 0;
+ SIM_CMD.mt = SIM_CMD.rt = SIM_CMD.lt = 0;
+ SIM_CMD.heading = lander.ang * 180.0 / PI;
+}
+
+/*
+  Flight interface
+*/
+static double Power(double power){
+ if (power < 0) power = 0;
+ if (power > 1) power = 1;
+ if (!SIM_NOISE) return power;
+ return .95 * power + .05 * Sim_Rand();
+}
+
+void Main_Thruster(double power){
+ SIM_CMD.mt = fmax(0, fmin(1, power));
+ lander.mt = Power(power);
+}
+
+void Left_Thruster(double power){
+ SIM_CMD.lt = fmax(0, fmin(1, power));
+ lander.lt = Power(power);
+}
+
+void Right_Thruster(double power){
+ SIM_CMD.rt = fmax(0, fmin(1, power));
+ lander.rt = Power(power);
+}
+
+void Rotate(double angle){
+ SIM_CMD.heading = fmod(lander.ang * 180.0 / PI + angle + 720, 360);
+ if (SIM_NOISE) angle = .95 * angle + .05 * Sim_Rand();
+ lander.rot = angle * PI / 180.0;
+ SIM_ROT_SET = 1;
+}
+
+double Velocity_X(void){
+ if (!SIM_COMP_OK[4]) return Sim_Rand() * 50.0 - 25.0;
+ return lander.vx + Noise(.05) * lander.vx;
+}
+
+double Velocity_Y(void){
+ if (!SIM_COMP_OK[5]) return Sim_Rand() * 50.0 - 25.0;
+ return lander.vy + Noise(.05) * lander.vy;
+}
+
+double Position_X(void){
+ if (!SIM_COMP_OK[6]) return Sim_Rand() * SIM_W;
+ return lander.x + Noise(.05) * lander.x;
+}
+
+double Position_Y(void){
+ if (!SIM_COMP_OK[7]) return Sim_Rand() * SIM_H;
+ return lander.y + Noise(.05) * lander.y;
+}
+
+double Angle(void){
+ if (!SIM_COMP_OK[8]) return (lander.ang + Sim_Rand() * 2.5 - 1.25) * 180.0 / PI;
+ return (lander.ang + Noise(.05)) * 180.0 / PI;
+}
+
+double RangeDist(void){
+ double dx = -sin(lander.ang), dy = cos(lander.ang);
+ for (int i = 0; i < 1024; i++)
+  if (Sim_Terrain((int)round(lander.x + i * dx), (int)round(lander.y + i * dy))) return i - 19;
+ return -1;
+}
+
+/*
+  Sonar: one wavefront per ray growing SIM_SONAR_STEP pixels per step,
+  rays that never hit anything within a ping read -1.
+*/
+void Sim_Sonar_Scan(void){
+ double a, dx, dy, r0;
+
+ ping_time += T_STEP;
+ if (SIM_COMP_OK[9]){
+  for (int i = 0; i < 36; i++){
+   if (ping_hit[i]) continue;
+   a = lander.ang + i * 10.0 * PI / 180.0;
+   dx = sin(a);
+   dy = -cos(a);
+   r0 = ping_r[i];
+   ping_r[i] += SIM_SONAR_STEP;
+   for (double r = r0; r < ping_r[i]; r += 1.0)
+    if (Sim_Terrain((int)round(lander.x + r * dx), (int)round(lander.y + r * dy))){
+     SONAR_DIST[i] = r + Noise(2.0);
+     ping_hit[i] = 1;
+     break;
+    }
+  }
+ }
+ if (ping_time < SIM_PING_TIME) return;
+
+ ping_time = 0;
+ for (int i = 0; i < 36; i++){
+  if (!SIM_COMP_OK[9]) SONAR_DIST[i] = Sim_Rand() < .5 ? -1 : Sim_Rand() * ping_r[i];
+  else if (!ping_hit[i]) SONAR_DIST[i] = -1;
+  ping_r[i] = SIM_SONAR_START;
+  ping_hit[i] = 0;
+ }
+}
+
+static void Integrate(void){
+ double ax, ay, d, s, c;
+
+ if (lander.rot > 0){
+  d = fmin(lander.rot, MAX_ROT_RATE);
+  rot_total += d;
+  lander.ang += d;
+  lander.rot -= d;
+ }
+ else if (lander.rot < 0){
+  d = fmin(-lander.rot, MAX_ROT_RATE);
+  rot_total += d;
+  lander.ang -= d;
+  lander.rot += d;
+ }
+ if (lander.ang < 0) lander.ang += 2 * PI;
+ lander.ang = fmod(lander.ang, 2 * PI);
+
+ s = sin(lander.ang);
+ c = cos(lander.ang);
+ ax = 0;
+ ay = -G_ACCEL;
+ if (lander.mt > 0 && SIM_COMP_OK[1]){
+  ax += MT_ACCEL * lander.mt * s;
+  ay += MT_ACCEL * lander.mt * c;
+ }
+ if (lander.lt > 0 && SIM_COMP_OK[2]){
+  ax += LT_ACCEL * lander.lt * c;
+  ay -= LT_ACCEL * lander.lt * s;
+ }
+ if (lander.rt > 0 && SIM_COMP_OK[3]){
+  ax -= RT_ACCEL * lander.rt * c;
+  ay += RT_ACCEL * lander.rt * s;
+ }
+ lander.vx += ax * T_STEP;
+ lander.vy += ay * T_STEP;
+ lander.x += lander.vx * T_STEP * S_SCALE;
+ lander.y -= lander.vy * T_STEP * S_SCALE;
+}
+
+static int Contact(void){
+ int cx = (int)round(lander.x), cy = (int)round(lander.y);
+ int terrain = 0, platform = 0;
+ double deg;
+
+ if (lander.x < 0 || lander.x >= SIM_W || lander.y >= SIM_H) return SIM_CRASHED;
+ for (int dy = -SIM_LANDER_R; dy <= SIM_LANDER_R; dy += 2)
+  for (int dx = -SIM_LANDER_R; dx <= SIM_LANDER_R; dx += 2){
+   if (dx * dx + dy * dy > SIM_LANDER_R * SIM_LANDER_R) continue;
+   if (Sim_Platform(cx + dx, cy + dy)) platform = 1;
+   else if (Sim_Terrain(cx + dx, cy + dy)) terrain = 1;
+  }
+ if (terrain) return SIM_CRASHED;
+ if (!platform) return SIM_FLYING;
+
+ deg = lander.ang * 180.0 / PI;
+ if (deg > 180) deg = 360 - deg;
+ if (fabs(lander.vy) < SIM_MAX_SPEED && deg < SIM_MAX_ANGLE) return SIM_LANDED;
+ return SIM_CRASHED;
+}
+
+void Sim_Save(Sim_Snapshot *s){
+ s->lander = lander;
+ s->rng = rng;
+ memcpy(s->fail_comp, fail_comp, sizeof(fail_comp));
+ s->fail_done = fail_done;
+ memcpy(s->comp_ok, SIM_COMP_OK, sizeof(SIM_COMP_OK));
+ s->mt_ok = MT_OK;
+ s->rt_ok = RT_OK;
+ s->lt_ok = LT_OK;
+ s->fail_time = SIM_FAIL_TIME;
+ s->time = SIM_TIME;
+ s->rot_total = rot_total;
+ s->ticks = SIM_TICKS;
+ s->rot_set = SIM_ROT_SET;
+ s->noise = SIM_NOISE;
+ s->ping_time = ping_time;
+ memcpy(s->ping_r, ping_r, sizeof(ping_r));
+ memcpy(s->ping_hit, ping_hit, sizeof(ping_hit));
+ memcpy(s->sonar, SONAR_DIST, sizeof(SONAR_DIST));
+ s->cmd = SIM_CMD;
+ s->coast_left = coast_left;
+ s->coast_cmd = coast_cmd;
+ memcpy(s->flag_drop, flag_drop, sizeof(flag_drop));
+ Lander_Save(&s->fc);
+}
+
+void Sim_Restore(const Sim_Snapshot *s){
+ lander = s->lander;
+ rng = s->rng;
+ memcpy(fail_comp, s->fail_comp, sizeof(fail_comp));
+ fail_done = s->fail_done;
+ memcpy(SIM_COMP_OK, s->comp_ok, sizeof(SIM_COMP_OK));
+ MT_OK = s->mt_ok;
+ RT_OK = s->rt_ok;
+ LT_OK = s->lt_ok;
+ SIM_FAIL_TIME = s->fail_time;
+ SIM_TIME = s->time;
+ rot_total = s->rot_total;
+ SIM_TICKS = s->ticks;
+ SIM_ROT_SET = s->rot_set;
+ SIM_NOISE = s->noise;
+ ping_time = s->ping_time;
+ memcpy(ping_r, s->ping_r, sizeof(ping_r));
+ memcpy(ping_hit, s->ping_hit, sizeof(ping_hit));
+ memcpy(SONAR_DIST, s->sonar, sizeof(SONAR_DIST));
+ SIM_CMD = s->cmd;
+ coast_left = s->coast_left;
+ coast_cmd = s->coast_cmd;
+ memcpy(flag_drop, s->flag_drop, sizeof(flag_drop));
+ Lander_Restore(&s->fc);
+}
+
+// Whether the flight computer is still flying the same manoeuvre: its
+// heading target within SIM_COAST_HEADING of the tick before. Thrust
+// is left out, the live policies pulse it every few ticks and dead
+// reckoning follows thrust changes anyway (Motion_Update()).
+static int Settled(void){
+ double dh = fabs(fmod(SIM_CMD.heading - coast_cmd.heading + 540, 360) - 180);
+ coast_cmd = SIM_CMD;
+ return dh <= SIM_COAST_HEADING;
+}
+
+// Whether the flight computer sees room to dead reckon in, from what
+// it knows and nothing the simulator knows: its sonar is healthy, no
+// filtered return is within SIM_COAST_CLEAR px (the platform returns
+// like any terrain, so this covers the approach too). Checked every
+// tick, a coast ends as soon as a ping comes back close.
+static int Clear(void){
+ if (!RANGEDIST_OK) return 0;
+ for (int i = 0; i < 36; i++)
+  if (SONAR_CLEAN[i] > -1 && SONAR_CLEAN[i] < SIM_COAST_CLEAR) return 0;
+ return 1;
+}
+
+// Notes the tick each of the flight computer's sensor flags drops on,
+// components 4-9 in command line order
+static void Watch_Flags(void){
+ const int ok[SIM_N_COMP + 1] = {1, 1, 1, 1, VELOCITY_X_OK, VELOCITY_Y_OK, POSITION_X_OK,
+                                 POSITION_Y_OK, ANGLE_OK, RANGEDIST_OK};
+
+ for (int i = 4; i <= SIM_N_COMP; i++)
+  if (!ok[i] && flag_drop[i] < 0) flag_drop[i] = SIM_TIME;
+}
+
+int Sim_Step(void){
+ int measured;
+
+ if (!fail_done && SIM_FAIL_TIME >= 0 && SIM_TIME >= SIM_FAIL_TIME) Apply_Failures();
+
+ measured = coast_left == 0;
+ if (SIM_BEFORE_CONTROL) SIM_BEFORE_CONTROL();
+ if (measured){
+  Lander_Control();
+  SIM_MEASURED++;
+ }
+ else {
+  coast_left--;
+  Lander_Coast();
+ }
+ Safety_Override();
+ Watch_Flags();
+ if (SIM_AFTER_CONTROL) SIM_AFTER_CONTROL();
+ if (SIM_ACCEL){
+  if (!Settled() || !Clear()) coast_left = 0;
+  else if (measured) coast_left = SIM_COAST_TICKS - 1;
+ }
+
+ Integrate();
+ Terrain_Prefetch(lander.x, lander.y, lander.vx, lander.vy, SIM_REACH);
+ Sim_Sonar_Scan();
+ SIM_TIME += T_STEP;
+ SIM_TICKS++;
+ if (SIM_TIME > SIM_TIME_LIMIT) return SIM_TIMEOUT;
+ return Contact();
+}
+
+int Sim_Run(Sim_Result *res){
+ int outcome;
+
+ do outcome = Sim_Step(); while (outcome == SIM_FLYING);
+ Sim_Finish(outcome, res);
+ return outcome;
+}
+
+// Fills in res for an episode that ended with outcome, for callers
+// stepping it themselves
+void Sim_Finish(int outcome, Sim_Result *res){
+ double deg = lander.ang * 180.0 / PI;
+
+ res->outcome = outcome;
+ res->ticks = SIM_TICKS;
+ res->t = SIM_TIME;
+ res->vx = lander.vx;
+ res->vy = lander.vy;
+ res->ang = deg > 180 ? 360 - deg : deg;
+ res->turned = rot_total * 180.0 / PI;
+ res->missed = res->false_alarms = 0;
+ for (int i = 0; i <= SIM_N_COMP; i++){
+  res->detect[i] = -1;
+  if (i < 4) continue;
+  if (flag_drop[i] >= 0 && (!fail_done || !fail_comp[i] || flag_drop[i] < SIM_FAIL_TIME))
+   res->false_alarms++;
+  else if (flag_drop[i] >= 0) res->detect[i] = flag_drop[i] - SIM_FAIL_TIME;
+  else if (fail_done && fail_comp[i]) res->missed++;
+ }
+}
+
+// Parses "mode [component ...]" the same way Lander_Control does
+int Sim_Parse_Mode(int argc, char **argv, int *mode, int *comp, int *ncomp){
+ *ncomp = 0;
+ if (argc < 1) return 0;
+ *mode = atoi(argv[0]);
+ if (*mode < 0 || *mode > 3) return 0;
+ for (int i = 1; i < argc && *ncomp < SIM_N_COMP; i++){
+  comp[*ncomp] = atoi(argv[i]);
+  if (comp[*ncomp] < 1 || comp[*ncomp] > SIM_N_COMP) return 0;
+  (*ncomp)++;
+ }
+ return 1;
+}
+
+const char *Sim_Outcome_Name(int outcome){
+ switch (outcome){
+  case SIM_LANDED: return "landed";
+  case SIM_CRASHED: return "crashed";
+  case SIM_TIMEOUT: return "timeout";
+ }
+ return "flying";
+}
+
+// Bin i holds (MIN * gamma^(i-1), MIN * gamma^i], gamma = (1+a)/(1-a)
+static const double sketch_gamma = (1 + SIM_SKETCH_ALPHA) / (1 - SIM_SKETCH_ALPHA);
+static const double sketch_scale = 1 / log(sketch_gamma);
+
+void Sim_Sketch_Reset(Sim_Sketch *s){
+ memset(s, 0, sizeof(*s));
+ s->min = HUGE_VAL;
+ s->max = -HUGE_VAL;
+}
+
+void Sim_Sketch_Add(Sim_Sketch *s, double v){
+ int i;
+
+ s->n++;
+ s->sum += v;
+ if (v < s->min) s->min = v;
+ if (v > s->max) s->max = v;
+ if (v <= SIM_SKETCH_MIN){
+  s->zero++;
+  return;
+ }
+ i = (int)ceil(log(v / SIM_SKETCH_MIN) * sketch_scale);
+ s->bin[i < SIM_SKETCH_BINS ? i : SIM_SKETCH_BINS - 1]++;
+}
+
+void Sim_Sketch_Merge(Sim_Sketch *s, const Sim_Sketch *o){
+ s->n += o->n;
+ s->zero += o->zero;
+ s->sum += o->sum;
+ if (o->min < s->min) s->min = o->min;
+ if (o->max > s->max) s->max = o->max;
+ for (int i = 0; i < SIM_SKETCH_BINS; i++) s->bin[i] += o->bin[i];
+}
+
+// Value of rank q * (n - 1), 0 for an empty sketch
+double Sim_Sketch_Quantile(const Sim_Sketch *s, double q){
+ long rank, seen;
+ double v;
+
+ if (!s->n) return 0;
+ if (q <= 0) return s->min;
+ if (q >= 1) return s->max;
+ rank = (long)(q * (s->n - 1));
+ seen = s->zero;
+ if (rank < seen) return s->min;
+ for (int i = 0; i < SIM_SKETCH_BINS; i++){
+  seen += s->bin[i];
+  if (rank < seen){
+   // Centre of the bin in relative terms
+   v = SIM_SKETCH_MIN * 2 * pow(sketch_gamma, i) / (sketch_gamma + 1);
+   return v < s->min ? s->min : v > s->max ? s->max : v;
+  }
+ }
+ return s->max;
+}
+
+double Sim_Sketch_Mean(const Sim_Sketch *s){
+ return s->n ? s->sum / s->n : 0;
+}
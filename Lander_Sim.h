@@ -0,0 +1,176 @@
+#ifndef _LANDER_SIM_H
+#define _LANDER_SIM_H
+
+/*
+  Headless simulator.
+
+  Lander_Control.o only ships as object code and needs a GLUT window, so
+  it cannot be used for batch runs. This is a display-free
+  re-implementation of the same flight interface (the sensor/actuator
+  functions and globals declared in Lander_Control.h), following the
+  constants and update rules of the original state_update():
+
+   * Thrust commands are clamped to [0 1] and scaled by (.95 + .05 noise)
+   * Rotate() sets a pending rotation consumed at MAX_ROT_RATE per step
+   * Position/velocity/angle sensors carry the same proportional noise,
+     failed sensors return garbage in the same ranges
+   * Sonar is an expanding ping, re-fired every SIM_PING_TIME seconds
+
+  Crash/landing detection and the failure schedule are approximations
+  of the GUI simulator, good enough for comparing controllers against
+  each other, not for absolute claims about the GUI runs.
+*/
+
+#define SIM_PING_TIME .25
+#define SIM_SONAR_START 15.0
+#define SIM_SONAR_STEP 9.0
+#define SIM_LANDER_R 16
+#define SIM_MAX_TIME 120.0     // per 1024px of map, see SIM_TIME_LIMIT
+#define SIM_MAX_SPEED 10.0
+#define SIM_MAX_ANGLE 15.0
+// Farthest a ping reaches, the terrain around it is prefetched
+#define SIM_REACH (SIM_SONAR_START + SIM_SONAR_STEP * SIM_PING_TIME / T_STEP)
+
+// Accelerated mode (SIM_ACCEL). Averaging POSITION_SAMPLES position
+// readings is nearly all of what a tick of the flight computer costs.
+// Away from terrain and the platform, and while its commands stay
+// settled, it runs Lander_Coast() instead for up to SIM_COAST_TICKS - 1
+// ticks at a time. Lander_Coast() dead reckons the position. The
+// flight computer still decides every tick and physics, sonar and
+// contact still run every T_STEP; only position measurements are
+// skipped. A sonar return within SIM_COAST_CLEAR px, a failed sonar or
+// a new heading target brings back measurements, all of it the flight
+// computer's own state rather than the true terrain. Nothing is held
+// back around the failure time: the "health" stage reads the sensors
+// on coasted ticks too, so a fault is flagged as soon as without
+// coasting. Individual flights differ from full-rate ones, the noise
+// stream being drawn differently, but not their outcome statistics.
+#define SIM_COAST_TICKS 20
+#define SIM_COAST_CLEAR 60.0     // px
+#define SIM_COAST_HEADING 5.0    // heading target change (degrees) that ends one
+
+// Episode outcomes
+#define SIM_FLYING 0
+#define SIM_LANDED 1
+#define SIM_CRASHED 2
+#define SIM_TIMEOUT 3
+
+// Components, numbered as on the Lander_Control command line
+#define SIM_N_COMP 9
+
+struct Sim_Lander {
+ double x, y;        // pixels, y grows downward
+ double vx, vy;      // m/s, vy positive upward
+ double ang;         // radians, clockwise from vertical, [0 2*PI)
+ double rot;         // pending rotation in radians
+ double mt, lt, rt;  // thruster power actually applied
+};
+
+// Commands as the flight computer gave them, before actuator noise:
+// thrust clamped to [0 1] and the heading (degrees) the last Rotate()
+// was aiming for. They stay set until changed, like the actuators.
+struct Sim_Command {
+ double mt, rt, lt;
+ double heading;
+};
+
+struct Sim_Result {
+ int outcome;
+ int ticks;
+ double t;          // simulated seconds
+ double vx, vy;     // velocity at end of episode
+ double ang;        // degrees from vertical at end of episode, [0 180]
+ double turned;     // degrees turned through during the episode
+ // Fault detection, per component as numbered on the command line:
+ // seconds from the failure to the flight computer's *_OK flag for
+ // the sensor dropping, -1 if it didn't fail or the flag never dropped.
+ // Thrusters (1-3) are reported failed, there is nothing to detect.
+ double detect[SIM_N_COMP + 1];
+ int missed;        // failed sensors whose flag never dropped
+ int false_alarms;  // flags dropped for sensors that hadn't failed (yet)
+};
+
+// Everything a running episode depends on, simulator and flight
+// computer, except the map. Restoring one and stepping on continues the
+// flight exactly, reseeding after the restore branches it.
+struct Sim_Snapshot {
+ Sim_Lander lander;
+ unsigned long long rng;
+ int fail_comp[SIM_N_COMP + 1], fail_done, comp_ok[SIM_N_COMP + 1];
+ int mt_ok, rt_ok, lt_ok;
+ double fail_time, time, rot_total;
+ int ticks, rot_set, noise;
+ double ping_time, ping_r[36];
+ int ping_hit[36];
+ double sonar[36];
+ Sim_Command cmd;
+ int coast_left;
+ Sim_Command coast_cmd;
+ double flag_drop[SIM_N_COMP + 1];
+ Lander_State fc;
+};
+
+// Quantile sketch for campaign statistics (DDSketch). Positive values
+// go to logarithmic bins SIM_SKETCH_ALPHA wide in relative terms, so a
+// quantile comes back within 1% of the true sample whatever the number
+// of episodes, in a fixed 4KB. Sketches merge by adding up their bins,
+// so each worker keeps its own and they are combined once at the end.
+#define SIM_SKETCH_ALPHA .01
+#define SIM_SKETCH_MIN 1e-3      // smaller values are counted as zero
+#define SIM_SKETCH_BINS 1024     // up to SIM_SKETCH_MIN * 1.0202^1024, ~8e5
+
+struct Sim_Sketch {
+ long n, zero;
+ double min, max, sum;
+ unsigned int bin[SIM_SKETCH_BINS];
+};
+
+extern int SIM_W;               // map size, the pixels are in Lander_Terrain
+extern int SIM_H;
+extern double SIM_TIME_LIMIT;   // SIM_MAX_TIME scaled up for maps over 1024px
+extern int SIM_NOISE;           // 0 makes sensors and actuators exact
+extern int SIM_ACCEL;           // 1 dead reckons position away from terrain
+extern long SIM_MEASURED;       // Lander_Control() calls, the rest were Lander_Coast()
+extern int SIM_COMP_OK[SIM_N_COMP + 1];
+extern double SIM_FAIL_TIME;
+extern double SIM_TIME;
+extern int SIM_TICKS;
+extern int SIM_ROT_SET;         // Rotate() called since last Sim_Clear_Commands()
+extern Sim_Command SIM_CMD;
+// Called by Sim_Step() right before and right after the flight computer
+// runs, when set (see Lander_Shadow)
+extern void (*SIM_BEFORE_CONTROL)(void);
+extern void (*SIM_AFTER_CONTROL)(void);
+
+double Sim_Rand(void);
+void Sim_Seed(long seed);
+
+// Also takes "proc[:seed][:WxH]" for a generated map (Terrain_Generate),
+// without a seed every Sim_Reset() generates a new one from its seed
+int Sim_Load_Map(const char *name);
+int Sim_Generate_Map(long seed, int w, int h);
+void Sim_Free_Map(void);
+int Sim_Terrain(int x, int y);
+int Sim_Platform(int x, int y);
+
+void Sim_Reset(int mode, const int *comp, int ncomp, long seed);
+void Sim_Set_Lander(const Sim_Lander *l);
+void Sim_Get_Lander(Sim_Lander *l);
+void Sim_Clear_Commands(void);
+void Sim_Sonar_Scan(void);
+
+int Sim_Step(void);
+int Sim_Run(Sim_Result *res);
+void Sim_Finish(int outcome, Sim_Result *res);
+int Sim_Parse_Mode(int argc, char **argv, int *mode, int *comp, int *ncomp);
+const char *Sim_Outcome_Name(int outcome);
+void Sim_Save(Sim_Snapshot *s);
+void Sim_Restore(const Sim_Snapshot *s);
+
+void Sim_Sketch_Reset(Sim_Sketch *s);
+void Sim_Sketch_Add(Sim_Sketch *s, double v);
+void Sim_Sketch_Merge(Sim_Sketch *s, const Sim_Sketch *o);
+double Sim_Sketch_Quantile(const Sim_Sketch *s, double q);
+double Sim_Sketch_Mean(const Sim_Sketch *s);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+	Live telemetry over shared memory - see Lander_Telemetry.h
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+#include "Lander_Telemetry.h"
+
+static Telemetry_Segment *seg = NULL;
+static char seg_name[256];
+static Telemetry_Frame run;     // the run fields, copied into every frame
+
+static int Shm_Name(const char *name){
+ return snprintf(seg_name, sizeof(seg_name), "/%s", name) < (int)sizeof(seg_name);
+}
+
+int Telemetry_Open(const char *name){
+ int fd;
+
+ if (!Shm_Name(name)) return 0;
+ fd = shm_open(seg_name, O_CREAT | O_RDWR, 0644);
+ if (fd < 0 || ftruncate(fd, sizeof(Telemetry_Segment)) < 0){
+  perror(seg_name);
+  if (fd >= 0) close(fd);
+  return 0;
+ }
+ seg = (Telemetry_Segment *)mmap(NULL, sizeof(Telemetry_Segment), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+ close(fd);
+ if (seg == MAP_FAILED){
+  perror("mmap");
+  seg = NULL;
+  return 0;
+ }
+ // Readers check the magic last, so a half set up segment is never read
+ seg->magic = 0;
+ __atomic_store_n(&seg->seq, 0, __ATOMIC_RELAXED);
+ seg->version = TELEMETRY_VERSION;
+ seg->pid = (int)getpid();
+ for (int i = 0; i < STAGE_N; i++)
+  snprintf(seg->stage_name[i], sizeof(seg->stage_name[i]), "%s", LANDER_STAGES[i].name);
+ memset(&seg->frame, 0, sizeof(seg->frame));
+ memset(&run, 0, sizeof(run));
+ __atomic_store_n(&seg->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+ return 1;
+}
+
+// The last frame stays readable with running = 0 until the segment is
+// unlinked, which readers that already have it mapped don't notice
+void Telemetry_Close(void){
+ if (!seg) return;
+ run.running = 0;
+ Telemetry_Publish();
+ munmap(seg, sizeof(Telemetry_Segment));
+ shm_unlink(seg_name);
+ seg = NULL;
+}
+
+void Telemetry_Run(long episode, long episodes, long seed, int mode, const int *count){
+ run.running = 1;
+ run.episode = episode;
+ run.episodes = episodes;
+ run.seed = seed;
+ run.mode = mode;
+ memcpy(run.count, count, sizeof(run.count));
+}
+
+// Sequence lock writer, fits SIM_AFTER_CONTROL. The frame is put
+// together on the stack and copied in, so the count is odd only for
+// the copy.
+void Telemetry_Publish(void){
+ Telemetry_Frame f = run;
+ Sim_Lander l;
+ unsigned long seq;
+
+ if (!seg) return;
+ Sim_Get_Lander(&l);
+ f.tick = SIM_TICKS;
+ f.t = SIM_TIME;
+ f.x = l.x;
+ f.y = l.y;
+ f.vx = l.vx;
+ f.vy = l.vy;
+ f.ang = l.ang * 180 / PI;
+ f.mt = SIM_CMD.mt;
+ f.rt = SIM_CMD.rt;
+ f.lt = SIM_CMD.lt;
+ f.heading = SIM_CMD.heading;
+ memcpy(f.comp_ok, SIM_COMP_OK, sizeof(f.comp_ok));
+
+ f.est_x = POS_X[0];
+ f.est_y = POS_Y[0];
+ f.est_vx = Robust_Velocity_X();
+ f.est_vy = Robust_Velocity_Y();
+ f.est_ang = Robust_Angle();
+ f.sensor_ok[0] = VELOCITY_X_OK;
+ f.sensor_ok[1] = VELOCITY_Y_OK;
+ f.sensor_ok[2] = POSITION_X_OK;
+ f.sensor_ok[3] = POSITION_Y_OK;
+ f.sensor_ok[4] = ANGLE_OK;
+ f.sensor_ok[5] = RANGEDIST_OK;
+ f.policy = POLICY_MODE;
+ f.phase = LANDER_PHASE;
+ for (int i = 0; i < STAGE_N; i++){
+  const Lander_Stage *st = &LANDER_STAGES[i];
+  f.stage_last[i] = st->last * 1e6;
+  f.stage_mean[i] = st->runs ? st->total / st->runs * 1e6 : 0;
+ }
+ f.tick_last = LANDER_TICK.last * 1e6;
+ f.tick_mean = LANDER_TICK.runs ? LANDER_TICK.total / LANDER_TICK.runs * 1e6 : 0;
+ f.tick_worst = LANDER_TICK.worst * 1e6;
+ f.ticks = LANDER_TICK.runs;
+ f.misses = LANDER_TICK.misses;
+
+ seq = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+ __atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+ __atomic_thread_fence(__ATOMIC_RELEASE);
+ memcpy(&seg->frame, &f, sizeof(f));
+ __atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+const Telemetry_Segment *Telemetry_Attach(const char *name){
+ const Telemetry_Segment *s;
+ int fd;
+
+ if (!Shm_Name(name)) return NULL;
+ fd = shm_open(seg_name, O_RDONLY, 0);
+ if (fd < 0) return NULL;
+ s = (const Telemetry_Segment *)mmap(NULL, sizeof(Telemetry_Segment), PROT_READ, MAP_SHARED,
+                                     fd, 0);
+ close(fd);
+ if (s == MAP_FAILED) return NULL;
+ if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC ||
+     s->version != TELEMETRY_VERSION){
+  munmap((void *)s, sizeof(Telemetry_Segment));
+  return NULL;
+ }
+ return s;
+}
+
+// Sequence lock reader. 0 if the writer kept getting in the way.
+int Telemetry_Read(const Telemetry_Segment *s, Telemetry_Frame *f){
+ unsigned long before, after;
+
+ for (int i = 0; i < TELEMETRY_RETRIES; i++){
+  before = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+  if (before & 1) continue;
+  memcpy(f, &s->frame, sizeof(*f));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  after = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  if (before == after) return 1;
+ }
+ return 0;
+}
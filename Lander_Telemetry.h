@@ -0,0 +1,66 @@
+#ifndef _LANDER_TELEMETRY_H
+#define _LANDER_TELEMETRY_H
+
+/*
+  Live telemetry over POSIX shared memory.
+
+  A run with telemetry on (Lander_Headless -telemetry name) writes the
+  simulator and flight computer state into the shared memory object
+  /name after every tick: true pose and commands, the flight
+  computer's estimates and health flags, the policy, the cost of each
+  stage and the deadline misses. One writer, any number of readers.
+
+  The frame is guarded by a sequence lock. The writer makes the count
+  odd, writes the frame and makes it even again: no locks, no system
+  calls once the segment is mapped, and nothing a reader does can hold
+  it up. A reader copies the frame and keeps it only if the count was
+  the same even number before and after, otherwise it tries again.
+  Lander_Watch is the reference reader.
+*/
+
+#define TELEMETRY_NAME "lander"       // default object, /dev/shm/lander on Linux
+#define TELEMETRY_MAGIC 0x4c4e4454    // "LNDT"
+#define TELEMETRY_VERSION 2
+#define TELEMETRY_RETRIES 1000        // torn reads before Telemetry_Read() gives up
+
+struct Telemetry_Frame {
+ // Run
+ int running;                     // 0 once the writer is done
+ long episode, episodes, seed;
+ int mode;
+ int count[4];                    // outcomes of the finished episodes
+ // Simulator
+ int tick;
+ double t;
+ double x, y, vx, vy, ang;        // true pose, px, m/s, degrees
+ double mt, rt, lt, heading;      // commands
+ int comp_ok[SIM_N_COMP + 1];
+ // Flight computer
+ double est_x, est_y, est_vx, est_vy, est_ang;
+ int sensor_ok[6];                // VELOCITY_X/Y, POSITION_X/Y, ANGLE, RANGEDIST
+ int policy;
+ int phase;                       // PHASE_CRUISE ..., -1 before the first tick
+ double stage_last[STAGE_N], stage_mean[STAGE_N];  // us
+ double tick_last, tick_mean, tick_worst;          // us
+ long ticks, misses;
+};
+
+struct Telemetry_Segment {
+ unsigned int magic, version;
+ int pid;                         // of the writer
+ char stage_name[STAGE_N][16];
+ unsigned long seq;               // odd while the frame is being written
+ Telemetry_Frame frame;
+};
+
+// Writer
+int Telemetry_Open(const char *name);
+void Telemetry_Close(void);
+void Telemetry_Run(long episode, long episodes, long seed, int mode, const int *count);
+void Telemetry_Publish(void);
+
+// Reader
+const Telemetry_Segment *Telemetry_Attach(const char *name);
+int Telemetry_Read(const Telemetry_Segment *seg, Telemetry_Frame *f);
+
+#endif
@@ -0,0 +1,397 @@
+/*
+	Tiled terrain store - see Lander_Terrain.h
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Lander_Arena.h"
+#include "Lander_Control.h"
+#include "Lander_Terrain.h"
+
+#define TILE_MASK (TERRAIN_TILE - 1)
+#define TILE_BYTES (TERRAIN_TILE * TERRAIN_TILE * 3)
+
+Terrain_Stats TERRAIN_STATS;
+
+static FILE *file = NULL;
+static long data_off;                 // first pixel in the file
+static int map_w, map_h, tiles_x, tiles_y;
+static int *slot_of = NULL;           // tile -> cache slot, -1 if not loaded
+static int tile_in[TERRAIN_CACHE];    // cache slot -> tile, -1 if free
+static unsigned long used[TERRAIN_CACHE], clock_now;
+static unsigned char *pixels = NULL;  // TERRAIN_CACHE tiles of TILE_BYTES
+static size_t mark;                   // of the arena, before pixels
+static int last_tile = -1;
+static unsigned char *last_px;
+
+// Procedural map, see Terrain_Generate()
+struct Proc_Cave {
+ double x, y, rx, ry;
+};
+
+struct Proc_Ledge {
+ int x0, x1, y0, y1;
+};
+
+static int generated;
+static int *ground = NULL, ground_n;  // top row of the ground per column
+static int plat_x0, plat_x1, plat_y;  // platform columns (inclusive) and top row
+static int shaft_x0, shaft_x1;        // kept clear from the sky down to the platform
+static Proc_Cave caves[TERRAIN_CAVES];
+static Proc_Ledge ledges[TERRAIN_LEDGES];
+static int n_caves, n_ledges;
+static unsigned long long proc_seed;
+
+static void Proc_Pixel(int x, int y, unsigned char *p);
+
+// Empty cache for a w x h map, buffers kept from the last map if they
+// fit. They come from the arena, pixels first, and all go back to it
+// in Terrain_Close().
+static int Setup_Cache(int w, int h){
+ int n = ((w + TILE_MASK) >> TERRAIN_SHIFT) * ((h + TILE_MASK) >> TERRAIN_SHIFT);
+
+ if (!pixels){
+  mark = Arena_Mark();
+  pixels = (unsigned char *)Arena_Alloc((size_t)TERRAIN_CACHE * TILE_BYTES);
+ }
+ if (pixels && (!slot_of || n > tiles_x * tiles_y)) slot_of = (int *)Arena_Alloc(sizeof(int) * n);
+ if (!slot_of || !pixels){
+  fprintf(stderr, "Out of memory for the terrain cache\n");
+  return 0;
+ }
+ map_w = w;
+ map_h = h;
+ tiles_x = (w + TILE_MASK) >> TERRAIN_SHIFT;
+ tiles_y = (h + TILE_MASK) >> TERRAIN_SHIFT;
+ for (int i = 0; i < n; i++) slot_of[i] = -1;
+ for (int i = 0; i < TERRAIN_CACHE; i++){
+  tile_in[i] = -1;
+  used[i] = 0;
+ }
+ clock_now = 0;
+ last_tile = -1;
+ return 1;
+}
+
+int Terrain_Open(const char *name, int *w, int *h){
+ char line[1024];
+ int maxv, hdr = 0;
+
+ Terrain_Close();
+ file = fopen(name, "rb");
+ if (!file){
+  fprintf(stderr, "Unable to open map image %s, please check name and path\n", name);
+  return 0;
+ }
+ // P6 header, skipping GIMP style comment lines
+ while (hdr < 3 && fgets(line, 1024, file)){
+  if (line[0] == '#') continue;
+  if (hdr == 0 && strncmp(line, "P6", 2) == 0) hdr = 1;
+  else if (hdr == 1 && sscanf(line, "%d %d", w, h) == 2) hdr = 2;
+  else if (hdr == 2 && sscanf(line, "%d", &maxv) == 1) hdr = 3;
+ }
+ if (hdr < 3 || *w <= 0 || *h <= 0){
+  fprintf(stderr, "Failed to read .ppm header from %s\n", name);
+  Terrain_Close();
+  return 0;
+ }
+ data_off = ftell(file);
+ fseek(file, 0, SEEK_END);
+ if (ftell(file) < data_off + (long)*w * *h * 3){
+  fprintf(stderr, "Failed to read data from .ppm file %s\n", name);
+  Terrain_Close();
+  return 0;
+ }
+ if (!Setup_Cache(*w, *h)){
+  Terrain_Close();
+  return 0;
+ }
+ memset(&TERRAIN_STATS, 0, sizeof(TERRAIN_STATS));
+ return 1;
+}
+
+void Terrain_Close(void){
+ if (file) fclose(file);
+ if (pixels) Arena_Release(mark);
+ file = NULL;
+ slot_of = NULL;
+ pixels = NULL;
+ ground = NULL;
+ ground_n = 0;
+ generated = 0;
+ last_tile = -1;
+ map_w = map_h = tiles_x = tiles_y = 0;
+}
+
+int Terrain_Stream(int y, unsigned char *row){
+ size_t n = (size_t)map_w * 3;
+ if (y < 0 || y >= map_h) return 0;
+ if (generated){
+  for (int x = 0; x < map_w; x++) Proc_Pixel(x, y, row + 3 * x);
+  return 1;
+ }
+ if (!file) return 0;
+ return pread(fileno(file), row, n, data_off + (long)y * n) == (ssize_t)n;
+}
+
+// Slot holding tile t, read into the least recently used slot if need be
+static int Fetch(int t){
+ int s = slot_of[t], tx, ty, x0, w, rows;
+ unsigned char *p;
+
+ if (s >= 0){
+  used[s] = ++clock_now;
+  return s;
+ }
+ s = 0;
+ for (int i = 1; i < TERRAIN_CACHE; i++)
+  if (used[i] < used[s]) s = i;
+ if (tile_in[s] >= 0){
+  slot_of[tile_in[s]] = -1;
+  TERRAIN_STATS.evictions++;
+  if (tile_in[s] == last_tile) last_tile = -1;
+ }
+
+ // A row of the tile at a time, edge tiles are padded with black
+ tx = t % tiles_x;
+ ty = t / tiles_x;
+ x0 = tx << TERRAIN_SHIFT;
+ w = map_w - x0 < TERRAIN_TILE ? map_w - x0 : TERRAIN_TILE;
+ rows = map_h - (ty << TERRAIN_SHIFT) < TERRAIN_TILE ? map_h - (ty << TERRAIN_SHIFT) : TERRAIN_TILE;
+ p = pixels + (size_t)s * TILE_BYTES;
+ if (w < TERRAIN_TILE || rows < TERRAIN_TILE) memset(p, 0, TILE_BYTES);
+ if (generated)
+  for (int r = 0; r < rows; r++)
+   for (int x = 0; x < w; x++)
+    Proc_Pixel(x0 + x, (ty << TERRAIN_SHIFT) + r, p + (r * TERRAIN_TILE + x) * 3);
+ else for (int r = 0; r < rows; r++){
+  long y = ((long)ty << TERRAIN_SHIFT) + r;
+  if (pread(fileno(file), p + r * TERRAIN_TILE * 3, w * 3, data_off + (y * map_w + x0) * 3) != w * 3)
+   memset(p + r * TERRAIN_TILE * 3, 0, w * 3);
+ }
+ tile_in[s] = t;
+ slot_of[t] = s;
+ used[s] = ++clock_now;
+ TERRAIN_STATS.loads++;
+ return s;
+}
+
+const unsigned char *Terrain_Pixel(int x, int y){
+ int t;
+
+ if ((unsigned)x >= (unsigned)map_w || (unsigned)y >= (unsigned)map_h) return NULL;
+ // Lookups come in runs along a ray or over the lander, mostly in the
+ // tile of the one before
+ t = (y >> TERRAIN_SHIFT) * tiles_x + (x >> TERRAIN_SHIFT);
+ if (t != last_tile){
+  if (slot_of[t] < 0) TERRAIN_STATS.stalls++;
+  last_px = pixels + (size_t)Fetch(t) * TILE_BYTES;
+  last_tile = t;
+ }
+ return last_px + 3 * (((y & TILE_MASK) << TERRAIN_SHIFT) + (x & TILE_MASK));
+}
+
+// n pixels of row y from x0 on into dst, black off the map
+void Terrain_Row(int y, int x0, int n, unsigned char *dst){
+ while (n > 0){
+  int run = TERRAIN_TILE - (x0 & TILE_MASK);
+  const unsigned char *p = Terrain_Pixel(x0, y);
+  if (run > n) run = n;
+  if (p && x0 + run <= map_w) memcpy(dst, p, run * 3);
+  else
+   for (int i = 0; i < run; i++){
+    p = Terrain_Pixel(x0 + i, y);
+    if (p) memcpy(dst + i * 3, p, 3);
+    else memset(dst + i * 3, 0, 3);
+   }
+  dst += run * 3;
+  x0 += run;
+  n -= run;
+ }
+}
+
+// Loads the tiles within reach px of where the lander will be over the
+// next TERRAIN_AHEAD seconds, nearest in time first, at most
+// TERRAIN_PREFETCH of them. Tiles already there are marked as used.
+void Terrain_Prefetch(double x, double y, double vx, double vy, double reach){
+ int loaded = 0;
+
+ if (!file && !generated) return;
+ for (int k = 0; k <= 4; k++){
+  double t = TERRAIN_AHEAD * k / 4;
+  double px = x + vx * t * S_SCALE, py = y - (vy * t - .5 * G_ACCEL * t * t) * S_SCALE;
+  int tx0 = (int)floor((px - reach) / TERRAIN_TILE), tx1 = (int)floor((px + reach) / TERRAIN_TILE);
+  int ty0 = (int)floor((py - reach) / TERRAIN_TILE), ty1 = (int)floor((py + reach) / TERRAIN_TILE);
+  if (tx0 < 0) tx0 = 0;
+  if (ty0 < 0) ty0 = 0;
+  if (tx1 >= tiles_x) tx1 = tiles_x - 1;
+  if (ty1 >= tiles_y) ty1 = tiles_y - 1;
+  for (int ty = ty0; ty <= ty1; ty++)
+   for (int tx = tx0; tx <= tx1; tx++){
+    int t = ty * tiles_x + tx;
+    if (slot_of[t] >= 0) used[slot_of[t]] = ++clock_now;
+    else if (loaded < TERRAIN_PREFETCH){
+     Fetch(t);
+     loaded++;
+    }
+   }
+ }
+}
+
+/*
+  Procedural maps. Everything is a function of the seed: a ridged
+  ground profile, worked out per column, and a handful of caves and
+  ledges; pixels are only worked out when their tile is, so making a
+  map costs O(width), not O(pixels).
+*/
+static unsigned long long Mix(unsigned long long z){
+ z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+ z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+ return z ^ (z >> 31);
+}
+
+static double Hash01(long a, long b){
+ return (Mix(proc_seed ^ Mix((unsigned long long)a * 0x9e3779b97f4a7c15ULL + b)) >> 11) *
+        (1.0 / 9007199254740992.0);
+}
+
+static unsigned long long proc_rng;
+
+static double Proc_Rand(void){
+ proc_rng += 0x9e3779b97f4a7c15ULL;
+ return (Mix(proc_rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Ridged value noise in [0 1]: octaves of smoothly interpolated lattice
+// values folded at zero, so crests come to a point
+static double Ridge(int x){
+ double sum = 0, norm = 0, amp = 1, period = TERRAIN_RIDGE;
+
+ for (int o = 0; o < 5; o++){
+  double u = x / period, f = u - floor(u);
+  long i = (long)floor(u);
+  f = f * f * (3 - 2 * f);
+  double n = 2 * (Hash01(o, i) * (1 - f) + Hash01(o, i + 1) * f) - 1;
+  sum += amp * (1 - fabs(n));
+  norm += amp;
+  amp *= .5;
+  period *= .5;
+ }
+ return sum / norm;
+}
+
+static void Proc_Pixel(int x, int y, unsigned char *p){
+ int solid, v;
+
+ if (x >= plat_x0 && x <= plat_x1 && y >= plat_y && y < plat_y + TERRAIN_PLAT_T){
+  p[0] = 255;
+  p[1] = p[2] = 0;
+  return;
+ }
+ solid = y >= ground[x];
+ for (int i = 0; i < n_ledges && !solid; i++)
+  if (x >= ledges[i].x0 && x <= ledges[i].x1 && y >= ledges[i].y0 && y <= ledges[i].y1) solid = 1;
+ for (int i = 0; i < n_caves && solid; i++){
+  double dx = (x - caves[i].x) / caves[i].rx, dy = (y - caves[i].y) / caves[i].ry;
+  if (dx * dx + dy * dy < 1) solid = 0;
+ }
+ if (!solid){
+  p[0] = p[1] = p[2] = 0;
+  return;
+ }
+ // Rock, mottled in 4px blocks, never red enough to pass for platform
+ v = 70 + (int)(Mix(proc_seed ^ ((unsigned long long)(x >> 2) << 32 | (unsigned)(y >> 2))) & 63);
+ p[0] = v + 20;
+ p[1] = v + 10;
+ p[2] = v;
+}
+
+int Terrain_Generate(long seed, int w, int h, double *px, double *py){
+ int top = TERRAIN_SKY + 60, bottom = h - 40, pw, cx;
+ double relief;
+
+ if (w < 512 || h < TERRAIN_SKY + 300){
+  fprintf(stderr, "Procedural maps need at least 512x%d pixels\n", TERRAIN_SKY + 300);
+  return 0;
+ }
+ if (file){
+  fclose(file);
+  file = NULL;
+ }
+ if (!Setup_Cache(w, h)) return 0;
+ if (ground_n < w){
+  ground = (int *)Arena_Alloc(sizeof(int) * w);
+  ground_n = ground ? w : 0;
+  if (!ground){
+   fprintf(stderr, "Out of memory for the terrain cache\n");
+   return 0;
+  }
+ }
+ generated = 1;
+ proc_seed = Mix((unsigned long long)seed + 0x9e3779b97f4a7c15ULL);
+ proc_rng = proc_seed;
+
+ relief = (.3 + .7 * Proc_Rand()) * (bottom - top);
+ for (int x = 0; x < w; x++) ground[x] = bottom - (int)(relief * Ridge(x));
+
+ // Platform on the ground where it lands, the ground around it brought
+ // down to its foot so it sits proud, and a shaft above it kept clear
+ pw = 60 + (int)(40 * Proc_Rand());
+ cx = (int)(.1 * w + pw + Proc_Rand() * (.8 * w - 2 * pw));
+ plat_y = ground[cx];
+ if (plat_y > bottom - TERRAIN_PLAT_T) plat_y = bottom - TERRAIN_PLAT_T;
+ if (plat_y < top + 40) plat_y = top + 40;
+ plat_x0 = cx - pw / 2;
+ plat_x1 = plat_x0 + pw - 1;
+ shaft_x0 = plat_x0 - TERRAIN_CLEAR;
+ shaft_x1 = plat_x1 + TERRAIN_CLEAR;
+ for (int x = shaft_x0; x <= shaft_x1; x++)
+  if (x >= plat_x0 && x <= plat_x1) ground[x] = plat_y + TERRAIN_PLAT_T;
+  else if (ground[x] < plat_y + TERRAIN_PLAT_T) ground[x] = plat_y + TERRAIN_PLAT_T;
+
+ // Half the maps sink the platform into a narrow shaft between walls
+ if (Proc_Rand() < .5){
+  int wall = 30 + (int)(60 * Proc_Rand());
+  int wall_top = plat_y - 120 - (int)(200 * Proc_Rand());
+  if (wall_top < top) wall_top = top;
+  for (int x = shaft_x0 - wall; x < shaft_x0; x++)
+   if (x >= 0 && ground[x] > wall_top) ground[x] = wall_top;
+  for (int x = shaft_x1 + 1; x <= shaft_x1 + wall; x++)
+   if (x < w && ground[x] > wall_top) ground[x] = wall_top;
+ }
+
+ // Caves under the ground, breaking the surface now and then, and
+ // ledges off the ground overhanging whatever is next to them. Neither
+ // reaches the platform's shaft, nor can a ledge rise into the sky rows
+ // the lander starts in, so the platform is always reachable from them.
+ n_caves = n_ledges = 0;
+ for (int i = (int)(Proc_Rand() * (TERRAIN_CAVES + 1)); i > 0; i--){
+  Proc_Cave c;
+  int a = (int)(Proc_Rand() * w);
+  c.rx = 30 + 80 * Proc_Rand();
+  c.ry = 15 + 35 * Proc_Rand();
+  c.x = a;
+  c.y = ground[a] + 30 + 150 * Proc_Rand();
+  if (c.x + c.rx >= shaft_x0 && c.x - c.rx <= shaft_x1) continue;
+  caves[n_caves++] = c;
+ }
+ for (int i = (int)(Proc_Rand() * (TERRAIN_LEDGES + 1)); i > 0; i--){
+  Proc_Ledge l;
+  int a = (int)(Proc_Rand() * w), len = 40 + (int)(120 * Proc_Rand());
+  int thick = 8 + (int)(12 * Proc_Rand());
+  l.y0 = ground[a] - thick / 2;
+  l.y1 = l.y0 + thick;
+  l.x0 = Proc_Rand() < .5 ? a - len : a;
+  l.x1 = l.x0 + len;
+  if (l.y0 < top || (l.x1 >= shaft_x0 && l.x0 <= shaft_x1)) continue;
+  ledges[n_ledges++] = l;
+ }
+
+ *px = (plat_x0 + plat_x1) / 2.0;
+ *py = plat_y;
+ return 1;
+}
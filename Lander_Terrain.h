@@ -0,0 +1,56 @@
+#ifndef _LANDER_TERRAIN_H
+#define _LANDER_TERRAIN_H
+
+/*
+  Tiled terrain store for the headless simulator.
+
+  The map stays in its .ppm file and is read TERRAIN_TILE x TERRAIN_TILE
+  pixels at a time into a cache of TERRAIN_CACHE tiles, the least
+  recently used tile giving way when another is needed, so memory does
+  not depend on the size of the map. Sonar, RangeDist(), collision and
+  the renderer all look pixels up through Terrain_Pixel()/Terrain_Row().
+
+  A tile fetched in the middle of a sonar scan stalls that step on disk,
+  Terrain_Prefetch() loads the tiles along where the lander is going
+  ahead of time instead, a few per call so no single step pays for many.
+
+  Terrain_Generate() fills the same store from a seed instead of a file:
+  fractal ridges, caves, overhanging ledges and, on half the maps, a
+  narrow shaft down to the platform. Tiles are worked out when first
+  looked up, so a new map costs a pass over its width, no disk and no
+  per pixel work up front. Nothing is ever built into the TERRAIN_SKY
+  rows the lander starts in or the shaft above the platform, so the
+  platform can always be reached.
+*/
+
+#define TERRAIN_SHIFT 8
+#define TERRAIN_TILE (1 << TERRAIN_SHIFT)   // px
+#define TERRAIN_CACHE 64                    // tiles kept, 12MB
+#define TERRAIN_PREFETCH 2                  // tiles loaded per Terrain_Prefetch() at most
+#define TERRAIN_AHEAD 1.0                   // s of flight prefetched ahead
+
+// Procedural maps
+#define TERRAIN_SKY 200       // rows kept clear at the top
+#define TERRAIN_RIDGE 384     // px, longest ridge wavelength
+#define TERRAIN_PLAT_T 8      // platform thickness, px
+#define TERRAIN_CLEAR 24      // px kept clear either side of the platform
+#define TERRAIN_CAVES 8       // at most
+#define TERRAIN_LEDGES 4      // at most
+
+struct Terrain_Stats {
+ long loads;         // tiles read from disk or generated
+ long stalls;        // of which demanded by a lookup rather than prefetched
+ long evictions;
+};
+
+extern Terrain_Stats TERRAIN_STATS;
+
+int Terrain_Open(const char *name, int *w, int *h);
+void Terrain_Close(void);
+int Terrain_Stream(int y, unsigned char *row);     // row y straight from the file, not cached
+const unsigned char *Terrain_Pixel(int x, int y);  // RGB, NULL off the map, valid until the next lookup
+void Terrain_Row(int y, int x0, int n, unsigned char *dst);
+void Terrain_Prefetch(double x, double y, double vx, double vy, double reach);
+int Terrain_Generate(long seed, int w, int h, double *plat_x, double *plat_y);
+
+#endif
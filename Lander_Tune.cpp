@@ -0,0 +1,402 @@
+/*
+	Threshold tuner for the live policies.
+
+	Searches the Lander_Params values (see Lander_Control.h) with CMA-ES.
+	Every candidate flies the same seeds under each thruster
+	configuration (all working, and each one or two of them failed) on
+	each map, in parallel headless worker processes. The cost is the mean
+	landing time, crashes and timeouts counting as SIM_TIME_LIMIT, plus a
+	penalty for every configuration whose success rate falls below its
+	floor. By default the floor is what the starting parameters achieve,
+	so the tuner looks for faster landings without losing reliability.
+
+	A few seeds rank candidates by luck as much as by merit, and the one
+	with the lowest cost on them is the luckiest as often as the best.
+	So a generation's best only replaces the best so far once it also
+	costs less on held-out seeds, the -hold seeds after the search ones,
+	with floors of their own from the starting parameters. Episodes are
+	seeded, so the best so far keeps the held-out cost it was flown at.
+
+	  -g generations  CMA-ES generations (default 20)
+	  -l lambda       candidates per generation (default 4 + 3 ln n)
+	  -n seeds        episodes per configuration and map (default 2)
+	  -hold seeds     held-out episodes per configuration and map
+	                  (default 4)
+	  -s seed         first episode seed (default 1), also seeds the search
+	  -j workers      worker processes (default one per CPU)
+	  -floor f        success rate required of every configuration
+	  -o file         best parameters found (default tuned.params)
+
+	Maps are given as plain arguments, easy.ppm and hard.ppm by default.
+	The search starts from LANDER_PARAMS if set, the defaults otherwise,
+	and the result is flown with e.g.
+
+	     LANDER_PARAMS=tuned.params Lander_Headless hard.ppm 1 -n 100
+
+	Each value is searched in units of a quarter of its starting value
+	and kept on the same side of zero. column_l/r and hold_dx are kept
+	within PHASE_NEAR - PHASE_HYST px, past that the phases over the
+	platform never see them.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+
+#define TN_MAX_MAPS 8
+#define TN_NCONF 7
+#define TN_PENALTY 1000.0   // cost per unit of success rate under the floor
+
+// Failed thrusters of each configuration, 0 terminated
+static const int tn_conf[TN_NCONF][3] = {
+ {0}, {1}, {2}, {3}, {1, 2}, {1, 3}, {2, 3}
+};
+
+struct Tn_Job {
+ int cand, conf, map;
+ long seed;
+ int outcome;
+ double t;
+};
+
+static const char *maps[TN_MAX_MAPS];
+static int nmaps = 0;
+
+static double Gauss(void){
+ double u = Sim_Rand(), v = Sim_Rand();
+ return sqrt(-2 * log(u > 1e-300 ? u : 1e-300)) * cos(2 * PI * v);
+}
+
+// Episodes of all candidates of a generation, handed out one at a time
+// to forked workers. The flight computer keeps its state in globals, so
+// these can't be threads.
+static void Fly_Jobs(const Lander_Params *cand, Tn_Job *job, int njobs, int workers){
+ int *next = (int *)mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+ int status;
+
+ *next = 0;
+ fflush(stdout);
+ for (int w = 0; w < workers; w++){
+  if (fork()) continue;
+  int loaded = -1, i;
+  Sim_Result res;
+  while ((i = __sync_fetch_and_add(next, 1)) < njobs){
+   Tn_Job *j = &job[i];
+   int comp[3], ncomp = 0;
+   if (j->map != loaded){
+    if (loaded >= 0) Sim_Free_Map();
+    if (!Sim_Load_Map(maps[j->map])) _exit(1);
+    loaded = j->map;
+   }
+   while (ncomp < 3 && tn_conf[j->conf][ncomp]){
+    comp[ncomp] = tn_conf[j->conf][ncomp];
+    ncomp++;
+   }
+   LANDER_PARAMS = cand[j->cand];
+   Sim_Reset(ncomp ? 3 : 0, comp, ncomp, j->seed);
+   Sim_Run(&res);
+   j->outcome = res.outcome;
+   j->t = res.t;
+  }
+  _exit(0);
+ }
+ for (int w = 0; w < workers; w++)
+  if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)){
+   fprintf(stderr, "A worker failed, is every map readable?\n");
+   exit(1);
+  }
+ munmap(next, sizeof(int));
+}
+
+// Cost of every candidate, success rate per configuration in rate
+static void Evaluate(const Lander_Params *cand, int ncand, Tn_Job *job, int seeds, long seed,
+                     int workers, const double *floor, double *cost, double *rate){
+ int per = TN_NCONF * nmaps * seeds, n = 0;
+
+ for (int c = 0; c < ncand; c++)
+  for (int k = 0; k < TN_NCONF; k++)
+   for (int m = 0; m < nmaps; m++)
+    for (int e = 0; e < seeds; e++, n++){
+     job[n].cand = c;
+     job[n].conf = k;
+     job[n].map = m;
+     job[n].seed = seed + e;
+    }
+ Fly_Jobs(cand, job, n, workers);
+
+ for (int c = 0; c < ncand; c++){
+  double t = 0, *r = rate + c * TN_NCONF;
+  for (int k = 0; k < TN_NCONF; k++) r[k] = 0;
+  for (int i = c * per; i < (c + 1) * per; i++){
+   if (job[i].outcome == SIM_LANDED){
+    t += job[i].t;
+    r[job[i].conf]++;
+   }
+   else t += SIM_TIME_LIMIT;
+  }
+  cost[c] = t / per;
+  for (int k = 0; k < TN_NCONF; k++){
+   r[k] /= nmaps * seeds;
+   if (floor && r[k] < floor[k]) cost[c] += TN_PENALTY * (floor[k] - r[k]);
+  }
+ }
+}
+
+// Cyclic Jacobi eigen decomposition of the symmetric n x n matrix a
+// (destroyed): eigenvalues in d, eigenvectors in the columns of v
+static void Eigen(int n, double *a, double *d, double *v){
+ for (int i = 0; i < n; i++)
+  for (int j = 0; j < n; j++) v[i * n + j] = i == j;
+ for (int sweep = 0; sweep < 50; sweep++){
+  double off = 0;
+  for (int p = 0; p < n; p++)
+   for (int q = p + 1; q < n; q++) off += a[p * n + q] * a[p * n + q];
+  if (off < 1e-30) break;
+  for (int p = 0; p < n; p++)
+   for (int q = p + 1; q < n; q++){
+    double apq = a[p * n + q];
+    if (fabs(apq) < 1e-300) continue;
+    double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+    double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+    double c = 1 / sqrt(t * t + 1), s = t * c;
+    for (int k = 0; k < n; k++){
+     double akp = a[k * n + p], akq = a[k * n + q];
+     a[k * n + p] = c * akp - s * akq;
+     a[k * n + q] = s * akp + c * akq;
+    }
+    for (int k = 0; k < n; k++){
+     double apk = a[p * n + k], aqk = a[q * n + k];
+     a[p * n + k] = c * apk - s * aqk;
+     a[q * n + k] = s * apk + c * aqk;
+    }
+    for (int k = 0; k < n; k++){
+     double vkp = v[k * n + p], vkq = v[k * n + q];
+     v[k * n + p] = c * vkp - s * vkq;
+     v[k * n + q] = s * vkp + c * vkq;
+    }
+   }
+ }
+ for (int i = 0; i < n; i++) d[i] = a[i * n + i];
+}
+
+// Search point to parameters
+static void Decode(const double *z, const double *x0, Lander_Params *p){
+ double *v = (double *)p;
+ for (int i = 0; i < LP_N; i++){
+  double scale = fmax(.25 * fabs(x0[i]), .25);
+  v[i] = x0[i] + scale * z[i];
+  if (x0[i] > 0 && v[i] < .1 * x0[i]) v[i] = .1 * x0[i];
+  if (x0[i] < 0 && v[i] > .1 * x0[i]) v[i] = .1 * x0[i];
+ }
+ if (p->faulty > 25) p->faulty = 25;
+ // The column and hold checks only run in the phases over the platform
+ p->column_l = fmin(p->column_l, PHASE_NEAR - PHASE_HYST);
+ p->column_r = fmin(p->column_r, PHASE_NEAR - PHASE_HYST);
+ for (int k = 0; k < PT_NTHR; k++) p->hold_dx[k] = fmin(p->hold_dx[k], PHASE_NEAR - PHASE_HYST);
+}
+
+static void Print_Rates(const char *what, double cost, const double *rate){
+ printf("%s cost %.2f, success", what, cost);
+ for (int k = 0; k < TN_NCONF; k++){
+  printf(" ");
+  if (!tn_conf[k][0]) printf("none");
+  for (int i = 0; i < 3 && tn_conf[k][i]; i++) printf(i ? "+%d" : "%d", tn_conf[k][i]);
+  printf(":%.2f", rate[k]);
+ }
+ printf("\n");
+}
+
+int main(int argc, char *argv[]){
+ const int n = LP_N;
+ int gens = 20, lambda = 4 + (int)(3 * log((double)n)), seeds = 2, hold = 4;
+ int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+ long seed = 1;
+ double floor_all = -1;
+ const char *out = "tuned.params";
+
+ for (int i = 1; i < argc; i++){
+  if (!strcmp(argv[i], "-g") && i + 1 < argc) gens = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-l") && i + 1 < argc) lambda = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-n") && i + 1 < argc) seeds = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-hold") && i + 1 < argc) hold = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-s") && i + 1 < argc) seed = atol(argv[++i]);
+  else if (!strcmp(argv[i], "-j") && i + 1 < argc) workers = atoi(argv[++i]);
+  else if (!strcmp(argv[i], "-floor") && i + 1 < argc) floor_all = atof(argv[++i]);
+  else if (!strcmp(argv[i], "-o") && i + 1 < argc) out = argv[++i];
+  else if (argv[i][0] != '-' && nmaps < TN_MAX_MAPS) maps[nmaps++] = argv[i];
+  else {
+   fprintf(stderr, "Usage: Lander_Tune [map ...] [-g generations] [-l lambda] [-n seeds]"
+           " [-hold seeds] [-s seed] [-j workers] [-floor rate] [-o file]\n");
+   exit(1);
+  }
+ }
+ if (!nmaps){
+  maps[nmaps++] = "easy.ppm";
+  maps[nmaps++] = "hard.ppm";
+ }
+ if (lambda < 4) lambda = 4;
+ if (seeds < 1) seeds = 1;
+ if (hold < 1) hold = 1;
+ if (workers < 1) workers = 1;
+
+ // Picks up LANDER_PARAMS and LANDER_POLICY once, here, so the workers
+ // don't override the candidates with them
+ Policy_Select();
+
+ int mu = lambda / 2, njobs = (lambda + 1) * TN_NCONF * nmaps * (seeds > hold ? seeds : hold);
+ double *x0 = (double *)malloc(sizeof(double) * n);
+ double *w = (double *)malloc(sizeof(double) * mu);
+ double *mean = (double *)calloc(n, sizeof(double)), *old = (double *)malloc(sizeof(double) * n);
+ double *ps = (double *)calloc(n, sizeof(double)), *pc = (double *)calloc(n, sizeof(double));
+ double *C = (double *)calloc(n * n, sizeof(double)), *B = (double *)malloc(sizeof(double) * n * n);
+ double *D = (double *)malloc(sizeof(double) * n), *tmp = (double *)malloc(sizeof(double) * n * n);
+ double *z = (double *)malloc(sizeof(double) * lambda * n), *y = (double *)malloc(sizeof(double) * lambda * n);
+ double *cost = (double *)malloc(sizeof(double) * (lambda + 1));
+ double *rate = (double *)malloc(sizeof(double) * (lambda + 1) * TN_NCONF);
+ double floor[TN_NCONF], hold_floor[TN_NCONF], best_cost, best_hold, sigma = 1;
+ long flown = 0, flown_hold = 0;
+ int checks = 0, taken = 0;
+ int *order = (int *)malloc(sizeof(int) * lambda);
+ Lander_Params best = LANDER_PARAMS;
+ Lander_Params *cand = (Lander_Params *)mmap(NULL, sizeof(Lander_Params) * (lambda + 1),
+                                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+ Tn_Job *job = (Tn_Job *)mmap(NULL, sizeof(Tn_Job) * njobs, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+ memcpy(x0, &LANDER_PARAMS, sizeof(double) * n);
+ for (int i = 0; i < n; i++){
+  C[i * n + i] = 1;
+  B[i * n + i] = 1;
+  D[i] = 1;
+ }
+
+ // Standard CMA-ES settings (Hansen, The CMA Evolution Strategy: A Tutorial)
+ double wsum = 0, w2 = 0;
+ for (int i = 0; i < mu; i++) wsum += w[i] = log(mu + .5) - log(i + 1.0);
+ for (int i = 0; i < mu; i++){
+  w[i] /= wsum;
+  w2 += w[i] * w[i];
+ }
+ double mueff = 1 / w2;
+ double cc = (4 + mueff / n) / (n + 4 + 2 * mueff / n);
+ double cs = (mueff + 2) / (n + mueff + 5);
+ double c1 = 2 / ((n + 1.3) * (n + 1.3) + mueff);
+ double cmu = fmin(1 - c1, 2 * (mueff - 2 + 1 / mueff) / ((n + 2) * (n + 2) + mueff));
+ double damps = 1 + 2 * fmax(0, sqrt((mueff - 1) / (n + 1)) - 1) + cs;
+ double chin = sqrt((double)n) * (1 - 1.0 / (4 * n) + 1.0 / (21.0 * n * n));
+
+ cand[0] = LANDER_PARAMS;
+ Evaluate(cand, 1, job, seeds, seed, workers, NULL, cost, rate);
+ for (int k = 0; k < TN_NCONF; k++) floor[k] = floor_all >= 0 ? floor_all : rate[k];
+ best_cost = cost[0];
+ for (int k = 0; k < TN_NCONF; k++)
+  if (rate[k] < floor[k]) best_cost += TN_PENALTY * (floor[k] - rate[k]);
+ Print_Rates("start:", best_cost, rate);
+ Evaluate(cand, 1, job, hold, seed + seeds, workers, NULL, cost, rate);
+ for (int k = 0; k < TN_NCONF; k++) hold_floor[k] = floor_all >= 0 ? floor_all : rate[k];
+ best_hold = cost[0];
+ for (int k = 0; k < TN_NCONF; k++)
+  if (rate[k] < hold_floor[k]) best_hold += TN_PENALTY * (hold_floor[k] - rate[k]);
+ Print_Rates("start, held out:", best_hold, rate);
+ flown += TN_NCONF * nmaps * seeds;
+ flown_hold += TN_NCONF * nmaps * hold;
+
+ Sim_Seed(seed);
+ for (int g = 1; g <= gens; g++){
+  // Candidates mean + sigma * B D z
+  for (int k = 0; k < lambda; k++){
+   double *zk = z + k * n, *yk = y + k * n, zz[LP_N];
+   for (int i = 0; i < n; i++) zk[i] = Gauss();
+   for (int i = 0; i < n; i++){
+    yk[i] = 0;
+    for (int j = 0; j < n; j++) yk[i] += B[i * n + j] * D[j] * zk[j];
+    zz[i] = mean[i] + sigma * yk[i];
+   }
+   Decode(zz, x0, &cand[k]);
+  }
+  Evaluate(cand, lambda, job, seeds, seed, workers, floor, cost, rate);
+  flown += lambda * TN_NCONF * nmaps * seeds;
+
+  for (int k = 0; k < lambda; k++) order[k] = k;
+  for (int a = 1; a < lambda; a++)
+   for (int b = a; b > 0 && cost[order[b]] < cost[order[b - 1]]; b--){
+    int t = order[b];
+    order[b] = order[b - 1];
+    order[b - 1] = t;
+   }
+  if (cost[order[0]] < best_cost){
+   double c, r[TN_NCONF];
+   Evaluate(&cand[order[0]], 1, job, hold, seed + seeds, workers, hold_floor, &c, r);
+   flown_hold += TN_NCONF * nmaps * hold;
+   checks++;
+   printf("  held out: %.2f against %.2f for the best so far, %s\n", c, best_hold,
+          c < best_hold ? "taken" : "kept the best so far");
+   if (c < best_hold){
+    taken++;
+    best_cost = cost[order[0]];
+    best_hold = c;
+    best = cand[order[0]];
+    if (!Lander_Params_Save(out, &best)) fprintf(stderr, "Unable to write %s\n", out);
+   }
+  }
+
+  // Mean, evolution paths, covariance and step size
+  memcpy(old, mean, sizeof(double) * n);
+  for (int i = 0; i < n; i++){
+   mean[i] = 0;
+   for (int k = 0; k < mu; k++) mean[i] += w[k] * (old[i] + sigma * y[order[k] * n + i]);
+  }
+  // C^-1/2 (mean - old) / sigma = B D^-1 B' (mean - old) / sigma
+  double bt[LP_N], nps = 0;
+  for (int j = 0; j < n; j++){
+   bt[j] = 0;
+   for (int i = 0; i < n; i++) bt[j] += B[i * n + j] * (mean[i] - old[i]);
+   bt[j] /= D[j] * sigma;
+  }
+  for (int i = 0; i < n; i++){
+   double s = 0;
+   for (int j = 0; j < n; j++) s += B[i * n + j] * bt[j];
+   ps[i] = (1 - cs) * ps[i] + sqrt(cs * (2 - cs) * mueff) * s;
+   nps += ps[i] * ps[i];
+  }
+  nps = sqrt(nps);
+  int hsig = nps / sqrt(1 - pow(1 - cs, 2.0 * g)) / chin < 1.4 + 2.0 / (n + 1);
+  for (int i = 0; i < n; i++)
+   pc[i] = (1 - cc) * pc[i] + hsig * sqrt(cc * (2 - cc) * mueff) * (mean[i] - old[i]) / sigma;
+  for (int i = 0; i < n; i++)
+   for (int j = 0; j <= i; j++){
+    double r = 0;
+    for (int k = 0; k < mu; k++) r += w[k] * y[order[k] * n + i] * y[order[k] * n + j];
+    C[i * n + j] = (1 - c1 - cmu) * C[i * n + j]
+                   + c1 * (pc[i] * pc[j] + (1 - hsig) * cc * (2 - cc) * C[i * n + j])
+                   + cmu * r;
+    C[j * n + i] = C[i * n + j];
+   }
+  sigma *= exp(cs / damps * (nps / chin - 1));
+
+  memcpy(tmp, C, sizeof(double) * n * n);
+  Eigen(n, tmp, D, B);
+  for (int i = 0; i < n; i++) D[i] = sqrt(fmax(D[i], 1e-20));
+
+  printf("generation %d: best %.2f, this generation %.2f, sigma %.3f\n", g, best_cost,
+         cost[order[0]], sigma);
+  Print_Rates("  its best", cost[order[0]], rate + order[0] * TN_NCONF);
+ }
+
+ if (!Lander_Params_Save(out, &best)){
+  fprintf(stderr, "Unable to write %s\n", out);
+  exit(1);
+ }
+ printf("best cost %.2f, held out %.2f, written to %s\n", best_cost, best_hold, out);
+ printf("%d of %d held-out checks taken, %ld held-out episodes on top of %ld searching (%.0f%%)\n",
+        taken, checks, flown_hold, flown, 100.0 * flown_hold / flown);
+ return 0;
+}
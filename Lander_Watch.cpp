@@ -0,0 +1,108 @@
+/*
+	Live telemetry viewer.
+
+	Reads the telemetry a run publishes into shared memory (see
+	Lander_Telemetry.h) and redraws it on the terminal, at any rate and
+	without slowing the run down. Can be started before the run, it
+	waits for the segment to appear, and exits once the run is done.
+
+	  name          shared memory object (default lander)
+	  -hz rate      redraws per second (default 10)
+	  -once         print the current frame once and exit
+
+	e.g.
+
+	     Lander_Headless hard.ppm 2 -n 1000 -telemetry lander &
+	     Lander_Watch lander
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+#include "Lander_Telemetry.h"
+
+static const char *COMP_NAMES[SIM_N_COMP + 1] = {"", "main", "left", "right", "vx", "vy", "px",
+                                                 "py", "angle", "sonar"};
+static const char *SENSOR_NAMES[6] = {"vx", "vy", "px", "py", "angle", "sonar"};
+static const char *POLICY_NAMES[3] = {"live", "table", "plan"};
+
+static void Show(const char *name, const Telemetry_Segment *seg, const Telemetry_Frame *f){
+ printf("/%s  writer %d  %s  episode %ld/%ld  seed %ld  mode %d  landed %d crashed %d timeout %d\n",
+        name, seg->pid, f->running ? "running" : "done",
+        f->episode < f->episodes ? f->episode + 1 : f->episodes, f->episodes,
+        f->seed, f->mode, f->count[SIM_LANDED], f->count[SIM_CRASHED], f->count[SIM_TIMEOUT]);
+ printf("t %.2f s, tick %d\n\n", f->t, f->tick);
+ printf("            x        y       vx       vy     ang\n");
+ printf("true   %7.1f  %7.1f  %7.2f  %7.2f  %6.1f\n", f->x, f->y, f->vx, f->vy, f->ang);
+ printf("est    %7.1f  %7.1f  %7.2f  %7.2f  %6.1f\n", f->est_x, f->est_y, f->est_vx, f->est_vy,
+        f->est_ang);
+ printf("command  main %.2f  right %.2f  left %.2f  heading %.1f\n", f->mt, f->rt, f->lt,
+        f->heading);
+ printf("policy   %s, %s\n", f->policy >= 0 && f->policy < 3 ? POLICY_NAMES[f->policy] : "?",
+        f->phase >= 0 && f->phase < PHASE_N ? PHASE_NAMES[f->phase] : "-");
+ printf("failed  ");
+ for (int i = 1; i <= SIM_N_COMP; i++)
+  if (!f->comp_ok[i]) printf(" %s", COMP_NAMES[i]);
+ printf("\nflagged ");
+ for (int i = 0; i < 6; i++)
+  if (!f->sensor_ok[i]) printf(" %s", SENSOR_NAMES[i]);
+ printf("\n\nstage      last us   mean us\n");
+ for (int i = 0; i < STAGE_N; i++)
+  printf("%-9s %8.2f  %8.2f\n", seg->stage_name[i], f->stage_last[i], f->stage_mean[i]);
+ printf("tick      %8.2f  %8.2f   worst %.1f us, %ld of %ld ticks over %.0f ms\n", f->tick_last,
+        f->tick_mean, f->tick_worst, f->misses, f->ticks, STAGE_DEADLINE * 1e3);
+}
+
+int main(int argc, char *argv[]){
+ const char *name = TELEMETRY_NAME;
+ const Telemetry_Segment *seg = NULL;
+ Telemetry_Frame f;
+ double hz = 10;
+ int once = 0, waiting = 0;
+
+ for (int i = 1; i < argc; i++){
+  if (!strcmp(argv[i], "-hz") && i + 1 < argc) hz = atof(argv[++i]);
+  else if (!strcmp(argv[i], "-once")) once = 1;
+  else if (argv[i][0] != '-') name = argv[i];
+  else {
+   fprintf(stderr, "Usage: Lander_Watch [name] [-hz rate] [-once]\n");
+   exit(1);
+  }
+ }
+ if (hz <= 0) hz = 10;
+
+ while (!(seg = Telemetry_Attach(name))){
+  if (once){
+   fprintf(stderr, "No telemetry at /%s\n", name);
+   exit(1);
+  }
+  if (!waiting) fprintf(stderr, "Waiting for /%s ...\n", name);
+  waiting = 1;
+  usleep((useconds_t)(1e6 / hz));
+ }
+
+ for (;;){
+  int gone = kill(seg->pid, 0) < 0 && errno == ESRCH;
+
+  if (!Telemetry_Read(seg, &f)){
+   usleep((useconds_t)(1e6 / hz));
+   continue;
+  }
+  if (!once) printf("\033[H\033[J");
+  Show(name, seg, &f);
+  fflush(stdout);
+  if (once || !f.running) break;
+  if (gone){
+   printf("\nwriter gone\n");
+   break;
+  }
+  usleep((useconds_t)(1e6 / hz));
+ }
+ return 0;
+}
@@ -0,0 +1,244 @@
+/*
+	Policy table generator.
+
+	Sweeps the policy grid described in Lander_Control.h, places the
+	lander at every node in the headless simulator with noise switched
+	off, runs Lander_Control_M/R/L once and stores the resulting thrust
+	and rotation target. The runtime picks the table up with
+
+	     LANDER_POLICY=table LANDER_POLICY_TABLE=policy_table.bin
+
+	Usage: Policy_Gen [output] [-bench samples]
+
+	After writing the table it reports its size, the lookup latency
+	against the live policy, what a table mode decision costs with the
+	live policy filling in, how many random states between the grid
+	nodes the table answers for and how often it agrees with the live
+	policy on those.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Lander_Control.h"
+#include "Lander_Sim.h"
+
+static volatile double sink;
+static void (*policy[PT_NTHR])(void) = {Lander_Control_M, Lander_Control_R, Lander_Control_L};
+
+static double Wall_Time(void){
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs the live policy for thruster thr in the given state, returns the
+// thrust it left on and the absolute angle it is heading for
+static void Live(int thr, double dx, double dy, double vx, double vy, double ang,
+                 double *power, double *target){
+ Sim_Lander l;
+
+ memset(&l, 0, sizeof(l));
+ l.x = PLAT_X + dx;
+ l.y = PLAT_Y - dy;
+ l.vx = vx;
+ l.vy = vy;
+ l.ang = ang * PI / 180.0;
+ Sim_Set_Lander(&l);
+ Sim_Clear_Commands();
+ // Placed here with no past, the phase is where the lander is
+ Phase_Reset();
+ Phase_Update(l.x, l.y);
+ policy[thr]();
+ Sim_Get_Lander(&l);
+
+ *power = thr == 0 ? l.mt : thr == 1 ? l.rt : l.lt;
+ *target = ang;
+ if (SIM_ROT_SET) *target += l.rot * 180.0 / PI;
+ *target = fmod(*target, 360);
+ if (*target < 0) *target += 360;
+}
+
+// Marks, in slot PT_MASK of each cell's lower corner node, the angle
+// bins the cell is resolved in: the 16 corners at the angle nodes either
+// side agree on the target and lie within PT_SPREAD in thrust
+static void Resolve(PT_Entry *table){
+ const int sy = PT_NVX * PT_NVY * PT_LINE, sx = PT_NDY * sy;
+ const int svx = PT_NVY * PT_LINE, svy = PT_LINE;
+ PT_Entry *e;
+ int k, lo, hi, ok, mask;
+
+ for (int ix = 0; ix < PT_NDX - 1; ix++)
+  for (int iy = 0; iy < PT_NDY - 1; iy++)
+   for (int ivx = 0; ivx < PT_NVX - 1; ivx++)
+    for (int ivy = 0; ivy < PT_NVY - 1; ivy++){
+     e = table + ix * sx + iy * sy + ivx * svx + ivy * svy;
+     mask = 0;
+     for (int ib = 0; ib < PT_NANG; ib++){
+      lo = 255;
+      hi = 0;
+      ok = 1;
+      for (int c = 0; c < 16 && ok; c++){
+       k = (c & 1) * sx + (c >> 1 & 1) * sy + (c >> 2 & 1) * svx + (c >> 3 & 1) * svy;
+       for (int a = ib; a <= ib + 1; a++){
+        const PT_Entry *n = &e[k + a % PT_NANG];
+        if (n->target != e[ib].target) ok = 0;
+        if (n->power < lo) lo = n->power;
+        if (n->power > hi) hi = n->power;
+       }
+      }
+      if (ok && hi - lo <= PT_SPREAD) mask |= 1 << ib;
+     }
+     e[PT_MASK].power = mask & 255;
+     e[PT_MASK].target = mask >> 8;
+    }
+}
+
+static int Generate(const char *name){
+ FILE *f;
+ int dims[6] = {PT_NDX, PT_NDY, PT_NVX, PT_NVY, PT_NANG, PT_LINE};
+ size_t n = (size_t)PT_NTHR * PT_CELLS * PT_LINE;
+ PT_Entry *table, *e;
+ double power, target;
+
+ table = (PT_Entry *)calloc(n, sizeof(PT_Entry));
+ if (!table) return 0;
+ e = table;
+ for (int thr = 0; thr < PT_NTHR; thr++)
+  for (int ix = 0; ix < PT_NDX; ix++)
+   for (int iy = 0; iy < PT_NDY; iy++)
+    for (int ivx = 0; ivx < PT_NVX; ivx++)
+     for (int ivy = 0; ivy < PT_NVY; ivy++, e += PT_LINE)
+      for (int ia = 0; ia < PT_NANG; ia++){
+       Live(thr, PT_DX_NODES[ix], PT_DY_NODES[iy], PT_VX_NODES[ivx], PT_VY_NODES[ivy],
+            ia * 360.0 / PT_NANG, &power, &target);
+       e[ia].power = (unsigned char)lround(power * 255);
+       e[ia].target = (unsigned char)(lround(target * 256 / 360.0) & 255);
+      }
+ for (int thr = 0; thr < PT_NTHR; thr++) Resolve(table + (size_t)thr * PT_CELLS * PT_LINE);
+
+ f = fopen(name, "wb");
+ if (!f){
+  free(table);
+  return 0;
+ }
+ fwrite("LPTABL2", 1, 8, f);
+ fwrite(dims, sizeof(int), 6, f);
+ fwrite(table, sizeof(PT_Entry), n, f);
+ fclose(f);
+ free(table);
+ printf("wrote %s: %d nodes x %d angles x %d thrusters, %.1f KB (%.1f KB per thruster)\n",
+        name, PT_CELLS, PT_NANG, PT_NTHR, n * sizeof(PT_Entry) / 1024.0,
+        n * sizeof(PT_Entry) / 1024.0 / PT_NTHR);
+ return 1;
+}
+
+static void Random_State(double *s){
+ s[0] = PT_DX_NODES[0] + Sim_Rand() * (PT_DX_NODES[PT_NDX - 1] - PT_DX_NODES[0]);
+ s[1] = PT_DY_NODES[0] + Sim_Rand() * (PT_DY_NODES[PT_NDY - 1] - PT_DY_NODES[0]);
+ s[2] = PT_VX_NODES[0] + Sim_Rand() * (PT_VX_NODES[PT_NVX - 1] - PT_VX_NODES[0]);
+ s[3] = PT_VY_NODES[0] + Sim_Rand() * (PT_VY_NODES[PT_NVY - 1] - PT_VY_NODES[0]);
+ s[4] = Sim_Rand() * 360;
+}
+
+// A flight moves slowly through the grid, so besides independent random
+// states the latency is also measured along random walks
+static void Walk_State(double *s, const double *prev, int i){
+ if (i % 1000 == 0){
+  Random_State(s);
+  return;
+ }
+ s[0] = prev[0] + (Sim_Rand() - .5) * 2;
+ s[1] = prev[1] + (Sim_Rand() - .5) * 2;
+ s[2] = prev[2] + (Sim_Rand() - .5) * .2;
+ s[3] = prev[3] + (Sim_Rand() - .5) * .2;
+ s[4] = fmod(prev[4] + (Sim_Rand() - .5) * 8 + 360, 360);
+}
+
+// Lookups alone, or with fallback set what a table mode decision
+// costs: the lookup, and the live policy where the table declines
+static double Time_Lookups(const double *s, int samples, int fallback){
+ double t = Wall_Time(), power, target;
+ for (int i = 0; i < samples; i++){
+  if (!Policy_Table_Lookup(i % PT_NTHR, s[5 * i], s[5 * i + 1], s[5 * i + 2], s[5 * i + 3],
+                           s[5 * i + 4], &power, &target) && fallback)
+   Live(i % PT_NTHR, s[5 * i], s[5 * i + 1], s[5 * i + 2], s[5 * i + 3], s[5 * i + 4], &power, &target);
+  sink += power + target;
+ }
+ return Wall_Time() - t;
+}
+
+static void Bench(int samples){
+ double *s, t, t_live, t_table, t_walk, t_mode, t_mode_walk, power, target, lp, lt;
+ int agree_thrust = 0, agree_target = 0, covered = 0, thr;
+
+ s = (double *)malloc(sizeof(double) * 5 * samples);
+ for (int i = 0; i < samples; i++) Walk_State(s + 5 * i, s + 5 * (i - 1), i);
+ t_walk = Time_Lookups(s, samples, 0);
+ t_mode_walk = Time_Lookups(s, samples, 1);
+ for (int i = 0; i < samples; i++) Random_State(s + 5 * i);
+
+ t = Wall_Time();
+ for (int i = 0; i < samples; i++){
+  Live(i % PT_NTHR, s[5 * i], s[5 * i + 1], s[5 * i + 2], s[5 * i + 3], s[5 * i + 4], &power, &target);
+  sink += power + target;
+ }
+ t_live = Wall_Time() - t;
+
+ t_table = Time_Lookups(s, samples, 0);
+ t_mode = Time_Lookups(s, samples, 1);
+
+ for (int i = 0; i < samples; i++){
+  thr = i % PT_NTHR;
+  Live(thr, s[5 * i], s[5 * i + 1], s[5 * i + 2], s[5 * i + 3], s[5 * i + 4], &lp, &lt);
+  // Only where the table answers, the rest is the live policy itself
+  if (!Policy_Table_Lookup(thr, s[5 * i], s[5 * i + 1], s[5 * i + 2], s[5 * i + 3],
+                           s[5 * i + 4], &power, &target))
+   continue;
+  covered++;
+  if ((lp > .5) == (power > .5)) agree_thrust++;
+  if (fabs(fmod(target - lt + 540, 360) - 180) < 15) agree_target++;
+ }
+ free(s);
+
+ printf("live policy  %.1f ns per decision\n", t_live * 1e9 / samples);
+ printf("table lookup %.1f ns per decision on random states, %.1f ns along trajectories\n",
+        t_table * 1e9 / samples, t_walk * 1e9 / samples);
+ printf("table mode   %.1f ns per decision on random states, %.1f ns along trajectories,\n"
+        "             lookup plus the live policy where the table declines\n",
+        t_mode * 1e9 / samples, t_mode_walk * 1e9 / samples);
+ printf("table covers %.1f%% of %d random states, agreement there: thrust %.1f%%, "
+        "rotation target %.1f%%\n", 100.0 * covered / samples, samples,
+        covered ? 100.0 * agree_thrust / covered : 0, covered ? 100.0 * agree_target / covered : 0);
+}
+
+int main(int argc, char *argv[]){
+ const char *name = "policy_table.bin";
+ int samples = 100000;
+
+ for (int i = 1; i < argc; i++){
+  if (!strcmp(argv[i], "-bench") && i + 1 < argc) samples = atoi(argv[++i]);
+  else name = argv[i];
+ }
+
+ // The policies only look at offsets from the platform, any platform
+ // position will do
+ Sim_Reset(0, NULL, 0, 1);
+ SIM_NOISE = 0;
+ PLAT_X = 512;
+ PLAT_Y = 900;
+
+ if (!Generate(name)){
+  fprintf(stderr, "Unable to write policy table %s\n", name);
+  exit(1);
+ }
+ if (!Policy_Table_Load(name)){
+  fprintf(stderr, "Unable to read back policy table %s\n", name);
+  exit(1);
+ }
+ if (samples > 0) Bench(samples);
+ return 0;
+}